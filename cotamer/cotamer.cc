@@ -1,4 +1,5 @@
 #include "cotamer/cotamer.hh"
+#include "cotamer/runtime.hh"
 #include <iterator>
 #include <memory>
 #include <fcntl.h>
@@ -45,6 +46,13 @@ void driver::migrate_fd_close(int base_fd) {
     migrate_wake();
 }
 
+void driver::migrate_poke() {
+    // wake the driver without giving it anything; it will look for work
+    auto df = lock();
+    unlock(df | driver::df_nonempty);
+    migrate_wake();
+}
+
 
 // driver methods
 
@@ -52,7 +60,8 @@ thread_local std::unique_ptr<driver> driver::current{new driver};
 std::atomic<bool> driver::global_real_time;
 
 driver::driver()
-    : virtual_epoch_(std::chrono::system_clock::from_time_t(1634070069)),
+    : events_(new detail::slab_pool),
+      virtual_epoch_(std::chrono::system_clock::from_time_t(1634070069)),
       real_time_(global_real_time.load(std::memory_order_relaxed)) {
 }
 
@@ -86,6 +95,11 @@ bool driver::loop(looptype lt) {
             finish_migrate();
         }
 
+        // offer surplus spawned tasks to idle runtime drivers
+        if (worker_ && !asap_.empty()) {
+            runtime::share_work(*this);
+        }
+
         // process an aliquot of asap and migrated tasks
         for (size_t n = asap_quota; n != 0 && !asap_.empty(); --n) {
             auto eh = std::move(asap_.front());
@@ -122,6 +136,11 @@ bool driver::loop(looptype lt) {
             process_clearing();
         }
 
+        // an idle runtime driver steals spawned tasks from busy ones
+        if (worker_ && asap_.empty() && !clearing_) {
+            runtime::seek_work(*this);
+        }
+
         // compute timeout
         duration timeout;
         if (!asap_.empty()
@@ -224,10 +243,90 @@ void reset() {
 }
 
 
+// slab_pool methods
+
+namespace detail {
+
+slab_pool::~slab_pool() {
+    for (void* slab : slabs_) {
+        ::operator delete(slab);
+    }
+}
+
+void* slab_pool::allocate_unowned(size_t size) {
+    size_t bsize = header_size + size;
+    char* block = static_cast<char*>(::operator new(bsize < sizeof(free_block) ? sizeof(free_block) : bsize));
+    owner(block) = nullptr;
+    return block + header_size;
+}
+
+void* slab_pool::hard_carve(unsigned cls, size_t bsize) {
+    assert(bsize <= slab_size);
+    char* slab = static_cast<char*>(::operator new(slab_size));
+    slabs_.push_back(slab);
+    bump_[cls] = slab + bsize;
+    bump_end_[cls] = slab + slab_size;
+    ++ncarved_;
+    owner(slab) = this;
+    return slab + header_size;
+}
+
+void slab_pool::drain_remote() noexcept {
+    // The owner is alive, so `remote_` cannot be orphaned.
+    uintptr_t h = remote_.exchange(0, std::memory_order_acquire);
+    auto* fb = reinterpret_cast<free_block*>(h);
+    while (fb) {
+        auto* next = fb->next;
+        fb->next = free_[fb->cls];
+        free_[fb->cls] = fb;
+        ++nfree_;
+        fb = next;
+    }
+}
+
+void slab_pool::remote_free(free_block* fb) noexcept {
+    uintptr_t h = remote_.load(std::memory_order_relaxed);
+    while (true) {
+        if (h & remote_orphaned) {
+            if (orphan_live_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+            return;
+        }
+        fb->next = reinterpret_cast<free_block*>(h);
+        if (remote_.compare_exchange_weak(h, reinterpret_cast<uintptr_t>(fb),
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+void slab_pool::orphan() noexcept {
+    // From now on, every free goes through `remote_free`, which counts
+    // down `orphan_live_`. Blocks freed remotely before this point are on
+    // the stack we take here.
+    uintptr_t h = remote_.exchange(remote_orphaned, std::memory_order_acquire);
+    ptrdiff_t live = ncarved_ - nfree_;
+    for (auto* fb = reinterpret_cast<free_block*>(h); fb; fb = fb->next) {
+        --live;
+    }
+    if (orphan_live_.fetch_add(live, std::memory_order_acq_rel) + live == 0) {
+        delete this;
+    }
+}
+
+}
+
+
 // task functions
 
 namespace detail {
 
+void* frame_pool::allocate(size_t sz) {
+    return ::operator new(sz);
+}
+
 bool task_promise_base::resolve() {
     auto handle = base_handle();
     while (true) {
@@ -14,7 +14,10 @@
 #include <vector>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include "cotamer/frame_pool.hh"
+#include "cotamer/slab_pool.hh"
 #include "cotamer/timer_heap.hh"
+#include "cotamer/timer_wheel.hh"
 #include "cotamer/event_handle.hh"
 
 // cotamer/cotamer.hh
@@ -23,6 +26,10 @@
 // Define COTAMER_STATS to 1 to collect statistics.
 // #define COTAMER_STATS 1
 
+// Define COTAMER_TIMER_WHEEL to 1 to keep timers in a hierarchical timing
+// wheel (O(1) insertion) rather than a 4-ary heap. Ordering is identical.
+// #define COTAMER_TIMER_WHEEL 1
+
 namespace cotamer {
 
 // event
@@ -109,6 +116,7 @@ public:
 private:
     friend struct detail::task_promise<T>;
     friend task<T> forward<>(task<T>);
+    friend class runtime;
     handle_type handle_;
 };
 
@@ -170,6 +178,8 @@ task<T> forward(task<T> t);
 //
 //    Each thread has its own driver stored in `driver::current`. The free
 //    functions `now()`, `after()`, `loop()`, etc. delegate to it.
+//    A `cotamer::runtime` (cotamer/runtime.hh) runs several drivers on
+//    their own threads and balances spawned tasks among them.
 
 using system_time_point = std::chrono::system_clock::time_point;
 using steady_time_point = std::chrono::steady_clock::time_point;
@@ -230,15 +240,25 @@ private:
     friend struct detail::fd_body;
     friend class driver_guard;
     friend struct detail::task_final_awaiter;
+    friend struct detail::task_promise_base;
+    friend class detail::event_handle;
+    friend class runtime;
     friend void set_clock(cotamer::clock);
 
+    // first: outlive frames and event bodies freed in ~driver
+    std::unique_ptr<detail::slab_pool, detail::slab_pool::orphan_deleter> events_;
+    detail::frame_pool frames_;
     system_time_point virtual_epoch_;
     steady_time_point snow_;
     bool clearing_ = false;
     bool real_time_ = false;
     int guard_count_ = 0;
     std::deque<detail::event_handle> asap_;
+#if COTAMER_TIMER_WHEEL
+    timer_wheel<detail::event_handle> timed_;
+#else
     timer_heap<detail::event_handle> timed_;
+#endif
     std::vector<detail::event_handle> keepalives_;
 
     static constexpr uint32_t df_lock = 1;
@@ -247,6 +267,7 @@ private:
     std::atomic<int> wakefd_ = -1;
     std::vector<detail::event_handle> migrate_;
     std::vector<int> migrate_fd_close_;
+    detail::runtime_worker* worker_ = nullptr; // set if owned by a runtime
 
     int pollfd_ = -1;
     int epoll_wakefd_ = -1;
@@ -262,9 +283,12 @@ private:
     inline void unlock(uint32_t flags);
     void migrate_asap(detail::event_handle eh);
     void migrate_fd_close(int base_fd);
+    void migrate_poke();
     inline void migrate_wake();
     void finish_migrate();
 
+    inline void cancel_timer(detail::event_body* eb, unsigned pos);
+
     inline int pollfd();
     void hard_pollfd();
     void apply_fd_update(detail::fd_batch&, const detail::fd_update&);
@@ -546,6 +570,12 @@ struct statistics {
     std::atomic<size_t> promises_destroyed;
     std::atomic<size_t> events_allocated;
     std::atomic<size_t> events_destroyed;
+    std::atomic<size_t> events_slab_hits;   // event bodies reused from a slab free list
+    std::atomic<size_t> events_slab_carved; // event bodies carved from fresh slab space
+    std::atomic<size_t> events_remote_freed; // event bodies freed off their driver's thread
+    std::atomic<size_t> frames_pooled;      // coroutine frames reused from a pool
+    std::atomic<size_t> frames_allocated;   // coroutine frames from operator new
+    std::atomic<size_t> tasks_stolen;       // spawned tasks moved by runtime work stealing
 };
 extern statistics stats;
 #endif
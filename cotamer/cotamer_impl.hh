@@ -36,6 +36,9 @@ constexpr uint32_t efm_user = 0x3C0;      // mask of user flags
 constexpr uint32_t ef_interest = 1024;    // this quorum has 1 interest{}
                                           // (added once per interest{})
 
+// event_body::timer_pos_ when not in a timer set
+constexpr unsigned timer_npos = -1;
+
 // exception thrown during driver::clearing()
 struct clearing_exception {};
 
@@ -152,6 +155,7 @@ struct task_promise_base {
     bool resolving_ = false;               // is task awaiting resolve{}?
     bool forwarded_ = false;               // is task subject to cot::forward()?
     bool in_resolve_ = false;              // is resolve() currently driving me?
+    bool stealable_ = false;               // may a runtime move me to another driver?
     driver* home_;                         // coroutine home driver
     event_handle resolution_;              // resolution event (lazily created)
     event_handle interest_;                // interest event (lazily created)
@@ -166,6 +170,18 @@ struct task_promise_base {
         COTAMER_STAT_INCR(promises_destroyed);
     }
 
+    // Coroutine frames come from the current driver's frame_pool. A
+    // coroutine whose arguments are `std::allocator_arg, alloc, ...` (after
+    // `*this`, for member coroutines) gets its frame from `alloc` instead.
+    static inline void* operator new(size_t size);
+    template <typename Alloc, typename... Args>
+    static inline void* operator new(size_t size, std::allocator_arg_t,
+                                     const Alloc& alloc, const Args&...);
+    template <typename This, typename Alloc, typename... Args>
+    static inline void* operator new(size_t size, const This&, std::allocator_arg_t,
+                                     const Alloc& alloc, const Args&...);
+    static inline void operator delete(void* ptr, size_t size) noexcept;
+
     inline std::coroutine_handle<> base_handle() {
         return std::coroutine_handle<task_promise_base>::from_promise(*this);
     }
@@ -185,6 +201,93 @@ struct task_promise_base {
 };
 
 
+// Coroutine frame allocation
+//    Every frame ends with a `frame_deleter` slot. Pooled frames store
+//    nullptr there; allocator-backed frames store the function that returns
+//    them to their allocator, which is kept just past the slot.
+
+using frame_deleter = void (*)(void*, size_t) noexcept;
+
+inline constexpr size_t frame_deleter_offset(size_t size) noexcept {
+    return (size + alignof(frame_deleter) - 1) & ~(alignof(frame_deleter) - 1);
+}
+
+inline frame_deleter& frame_deleter_slot(void* ptr, size_t size) noexcept {
+    return *reinterpret_cast<frame_deleter*>(static_cast<char*>(ptr) + frame_deleter_offset(size));
+}
+
+template <typename Alloc>
+struct frame_allocator {
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) block {
+        char data[__STDCPP_DEFAULT_NEW_ALIGNMENT__];
+    };
+    using alloc_type = typename std::allocator_traits<Alloc>::template rebind_alloc<block>;
+    using traits_type = std::allocator_traits<alloc_type>;
+    static_assert(alignof(alloc_type) <= alignof(block));
+
+    static constexpr size_t alloc_offset(size_t size) noexcept {
+        size_t off = frame_deleter_offset(size) + sizeof(frame_deleter);
+        return (off + alignof(alloc_type) - 1) & ~(alignof(alloc_type) - 1);
+    }
+    static constexpr size_t nblocks(size_t size) noexcept {
+        return (alloc_offset(size) + sizeof(alloc_type) + sizeof(block) - 1) / sizeof(block);
+    }
+
+    [[gnu::noinline]] static void* allocate(size_t size, const Alloc& a) {
+        alloc_type alloc(a);
+        void* ptr = traits_type::allocate(alloc, nblocks(size));
+        frame_deleter_slot(ptr, size) = &deallocate;
+        new (static_cast<char*>(ptr) + alloc_offset(size)) alloc_type(std::move(alloc));
+        COTAMER_STAT_INCR(frames_allocated);
+        return ptr;
+    }
+    static void deallocate(void* ptr, size_t size) noexcept {
+        auto* ap = std::launder(reinterpret_cast<alloc_type*>(static_cast<char*>(ptr) + alloc_offset(size)));
+        alloc_type alloc(std::move(*ap));
+        ap->~alloc_type();
+        traits_type::deallocate(alloc, static_cast<block*>(ptr), nblocks(size));
+    }
+};
+
+inline void* task_promise_base::operator new(size_t size) {
+    size_t fsize = frame_pool::round_size(frame_deleter_offset(size) + sizeof(frame_deleter));
+    void* ptr = nullptr;
+    if (auto* d = driver::current.get()) {
+        ptr = d->frames_.pop(fsize);
+    }
+    if (ptr) {
+        COTAMER_STAT_INCR(frames_pooled);
+    } else {
+        ptr = frame_pool::allocate(fsize);
+        COTAMER_STAT_INCR(frames_allocated);
+    }
+    frame_deleter_slot(ptr, size) = nullptr;
+    return ptr;
+}
+
+template <typename Alloc, typename... Args>
+inline void* task_promise_base::operator new(size_t size, std::allocator_arg_t,
+                                             const Alloc& alloc, const Args&...) {
+    return frame_allocator<Alloc>::allocate(size, alloc);
+}
+
+template <typename This, typename Alloc, typename... Args>
+inline void* task_promise_base::operator new(size_t size, const This&, std::allocator_arg_t,
+                                             const Alloc& alloc, const Args&...) {
+    return frame_allocator<Alloc>::allocate(size, alloc);
+}
+
+inline void task_promise_base::operator delete(void* ptr, size_t size) noexcept {
+    if (auto deleter = frame_deleter_slot(ptr, size)) {
+        deleter(ptr, size);
+    } else if (auto* d = driver::current.get()) {
+        d->frames_.push(ptr, frame_pool::round_size(frame_deleter_offset(size) + sizeof(frame_deleter)));
+    } else {
+        ::operator delete(ptr);
+    }
+}
+
+
 template <typename T>
 struct task_promise : public task_promise_base {
     // Functions required by the C++ runtime
@@ -396,6 +499,11 @@ struct event_body {
     event_body& operator=(const event_body&) = delete;
     event_body& operator=(event_body&&) = delete;
 
+    // Bodies come from the current driver's slab_pool; class 0 holds
+    // event_bodies and class 1 quorum_event_bodies.
+    static inline void* operator new(size_t size);
+    static inline void operator delete(void* ptr, size_t size) noexcept;
+
     void ref(uint32_t n = 1) noexcept {
         refcount_.fetch_add(n, std::memory_order_relaxed);
     }
@@ -485,6 +593,8 @@ struct event_body {
     }
 
     inline std::coroutine_handle<> driver_trigger(driver* drv);
+    inline bool rehome_listener(driver* from, driver* to);
+    inline void trigger_held();
 
     inline bool trigger_unlock(uint32_t flags, driver* drv = nullptr,
                                std::coroutine_handle<>* cot = nullptr);
@@ -492,6 +602,7 @@ struct event_body {
 
     std::atomic<uint32_t> refcount_ = 1;
     std::atomic<uint32_t> flags_ = ef_empty;
+    std::atomic<unsigned> timer_pos_ = timer_npos; // position in a driver's timer set
     small_vector<uintptr_t, 3> listeners_;
 
 private:
@@ -642,6 +753,33 @@ struct quorum_event_body : event_body {
     uint32_t quorum_;
 };
 
+// event_body allocation
+
+inline void* event_body::operator new(size_t size) {
+    static_assert(alignof(quorum_event_body) <= slab_pool::header_size);
+    assert(size <= sizeof(quorum_event_body));
+    unsigned cls = size > sizeof(event_body);
+    size_t csize = cls ? sizeof(quorum_event_body) : sizeof(event_body);
+    auto* d = driver::current.get();
+    if (!d) {
+        return slab_pool::allocate_unowned(csize);
+    }
+    if (void* ptr = d->events_->pop(cls)) {
+        COTAMER_STAT_INCR(events_slab_hits);
+        return ptr;
+    }
+    COTAMER_STAT_INCR(events_slab_carved);
+    return d->events_->carve(cls, csize);
+}
+
+inline void event_body::operator delete(void* ptr, size_t size) noexcept {
+    auto* d = driver::current.get();
+    if (slab_pool::free(ptr, size > sizeof(event_body), d ? d->events_.get() : nullptr)) {
+        COTAMER_STAT_INCR(events_remote_freed);
+    }
+}
+
+
 // event_body::trigger_unlock: the key trigger machinery
 
 inline bool event_body::trigger_unlock(uint32_t f, driver* drv,
@@ -739,6 +877,35 @@ inline std::coroutine_handle<> event_body::driver_trigger(driver* drv) {
     return coh;
 }
 
+inline bool event_body::rehome_listener(driver* from, driver* to) {
+    // Used by runtime work stealing. Succeeds if this event has triggered and
+    // its only listener is a stealable coroutine homed on `from`. That
+    // coroutine will be resumed by whoever holds this event, so if `to` is
+    // nonnull, it can safely move to `to`.
+    auto f = lock();
+    bool ok = (f & ef_triggered)
+        && listeners_.size() == 1
+        && !(listeners_[0] & lf_quorum);
+    if (ok) {
+        auto& p = listener_coroutine(listeners_[0]).promise();
+        ok = p.stealable_ && p.home_ == from;
+        if (ok && to) {
+            p.home_ = to;
+        }
+    }
+    unlock(f);
+    return ok;
+}
+
+inline void event_body::trigger_held() {
+    // Used by `runtime::spawn`. Mark this event triggered without queuing
+    // its listeners: the caller holds it and queues it on a driver itself,
+    // whose `driver_trigger` then resumes the listener homed there.
+    auto f = lock();
+    assert(!(f & ef_triggered) && !(f & ef_quorum));
+    unlock(f | ef_triggered);
+}
+
 
 // event_handle implementation
 //    Reference-counted smart pointer for event_body
@@ -785,9 +952,19 @@ inline event_handle::~event_handle() {
         return;
     }
     auto f = eb_->relaxed_flags();
+    // Read the timer position while we still hold a reference
+    unsigned tpos = eb_->timer_pos_.load(std::memory_order_relaxed);
+    uint32_t rc;
     if ((f & (ef_quorum | ef_empty_members)) == ef_quorum) {
         static_cast<quorum_event_body*>(eb_)->hard_deref();
-    } else if (eb_->refcount_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    } else if ((rc = eb_->refcount_.fetch_sub(1, std::memory_order_acq_rel)) == 2) {
+        // If the last reference is a timer's, cancel the timer now
+        if (tpos != timer_npos) {
+            if (auto* d = driver::current.get()) {
+                d->cancel_timer(eb_, tpos);
+            }
+        }
+    } else if (rc != 1) {
         // do nothing
     } else if (f & ef_quorum) {
         delete static_cast<quorum_event_body*>(eb_);
@@ -806,6 +983,12 @@ inline bool event_handle::empty() const noexcept {
     return !eb_ || eb_->empty();
 }
 
+inline void event_handle::set_timer_position(unsigned pos) noexcept {
+    if (eb_) {
+        eb_->timer_pos_.store(pos, std::memory_order_relaxed);
+    }
+}
+
 
 
 // task_event_awaiter<T>
@@ -1718,6 +1901,17 @@ inline size_t driver::timer_size() const noexcept {
     return timed_.size();
 }
 
+inline void driver::cancel_timer(detail::event_body* eb, unsigned pos) {
+    // `eb` may be in another driver's timer set, or may have fired, or (if
+    // another thread dropped the last reference) may be gone. Only touch it
+    // if this driver's set holds it at `pos`, and only remove it if nobody
+    // else refers to it.
+    auto* t = timed_.at_position(pos);
+    if (t && t->get() == eb && !eb->triggered() && eb->empty()) {
+        timed_.erase(pos);
+    }
+}
+
 
 // file descriptor functions
 
@@ -1763,7 +1957,6 @@ inline event_handle fd_event_set::take(int fd, int interest, unsigned epoch) {
     }
     fdrec& fdi = fdrs_[ufd];
     if (!fdi.ev[interest]
-        || fdi.ev[interest]->empty()
         || (epoch && epoch != fdi.epoch)) {
         return event_handle();
     }
@@ -1771,6 +1964,13 @@ inline event_handle fd_event_set::take(int fd, int interest, unsigned epoch) {
         fdi.update_link_ = update_link_;
         update_link_ = ufd + 1;
     }
+    if (fdi.ev[interest]->empty()) {
+        // nobody waits for this event (e.g., it lost an `any`): drop the
+        // watch rather than leave it registered, which would keep the
+        // kernel reporting the fd and the loop from going quiescent
+        fdi.ev[interest] = nullptr;
+        return event_handle();
+    }
     return std::exchange(fdi.ev[interest], nullptr);
 }
 
@@ -10,12 +10,14 @@ namespace cotamer {
 class event;
 template <typename T> class task;
 class driver;
+class runtime;
 class fd;
 template <typename T> task<T> forward(task<T>);
 namespace detail {
 struct event_body;
 struct fd_body;
 struct quorum_event_body;
+struct task_promise_base;
 template <typename T> struct task_promise;
 template <typename T> struct task_awaiter;
 template <typename T> struct task_event_awaiter;
@@ -23,6 +25,7 @@ template <typename T, bool shared> struct task_mutex_event_awaiter;
 struct task_resolution_awaiter;
 struct task_final_awaiter;
 struct interest_event_awaiter;
+struct runtime_worker;
 
 class event_handle {
 public:
@@ -39,6 +42,7 @@ public:
     explicit operator bool() const noexcept { return eb_ != nullptr; }
     inline bool empty() const noexcept;
     inline bool idle() const noexcept;
+    inline void set_timer_position(unsigned pos) noexcept;
     event_body* get() const noexcept { return eb_; }
     event_body& operator*() const { return *eb_; }
     event_body* operator->() const noexcept { return eb_; }
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstddef>
+#include <new>
+
+// frame_pool.hh
+//    Defines cotamer::detail::frame_pool, the per-driver free lists that
+//    recycle coroutine frames. A frame is rounded up to a multiple of
+//    `granule` bytes; freed frames go on the list for their size class, and
+//    the next frame of that class pops one off. Frames bigger than
+//    `max_size` go straight to the global allocator, as do frames freed
+//    when a class's list already holds `max_class_bytes` worth of frames.
+
+namespace cotamer {
+namespace detail {
+
+class frame_pool {
+public:
+    static constexpr size_t granule = 64;
+    static constexpr size_t nclasses = 16;
+    static constexpr size_t max_size = granule * nclasses;
+    static constexpr size_t max_class_bytes = 512 << 10;
+
+    frame_pool() = default;
+    frame_pool(const frame_pool&) = delete;
+    frame_pool(frame_pool&&) = delete;
+    frame_pool& operator=(const frame_pool&) = delete;
+    frame_pool& operator=(frame_pool&&) = delete;
+    inline ~frame_pool();
+
+    // Return the allocation size for a frame of `sz` bytes.
+    static constexpr size_t round_size(size_t sz) noexcept {
+        return sz <= max_size ? (sz + granule - 1) & ~(granule - 1) : sz;
+    }
+
+    // Allocate a new frame of rounded size `sz`. Out of line, so the
+    // compiler does not pair this `::operator new` with the promise's
+    // class `operator delete`.
+    static void* allocate(size_t sz);
+    // Pop a free frame of rounded size `sz`, or return nullptr.
+    inline void* pop(size_t sz) noexcept;
+    // Push frame `p` of rounded size `sz`, or free it if the list is full.
+    inline void push(void* p, size_t sz) noexcept;
+
+private:
+    struct free_frame {
+        free_frame* next;
+    };
+
+    free_frame* free_[nclasses] = {};
+    unsigned nfree_[nclasses] = {};
+
+    static constexpr size_t size_class(size_t sz) noexcept {
+        return sz / granule - 1;
+    }
+};
+
+
+inline frame_pool::~frame_pool() {
+    for (auto*& head : free_) {
+        while (auto* ff = head) {
+            head = ff->next;
+            ::operator delete(ff);
+        }
+    }
+}
+
+inline void* frame_pool::pop(size_t sz) noexcept {
+    if (sz > max_size) {
+        return nullptr;
+    }
+    size_t c = size_class(sz);
+    auto* ff = free_[c];
+    if (ff) {
+        free_[c] = ff->next;
+        --nfree_[c];
+    }
+    return ff;
+}
+
+inline void frame_pool::push(void* p, size_t sz) noexcept {
+    if (sz > max_size) {
+        ::operator delete(p);
+        return;
+    }
+    size_t c = size_class(sz);
+    if (nfree_[c] >= max_class_bytes / sz) {
+        ::operator delete(p);
+        return;
+    }
+    free_[c] = new (p) free_frame{free_[c]};
+    ++nfree_[c];
+}
+
+}
+}
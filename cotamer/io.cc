@@ -279,7 +279,7 @@ void driver::apply_fd_update(detail::fd_batch& batch,
     batch.add(pollfd(), fdu, old_mask);
 
     // record the new notification state in `fdctl_`
-    fdctl_[fdci] ^= (old_mask ^ fdu.mask) << fdcs;
+    fdctl_[fdci] ^= uint64_t(old_mask ^ fdu.mask) << fdcs;
     if (old_mask == 0) {
         ++nfdctl_;
     } else if (fdu.mask == 0) {
@@ -291,8 +291,12 @@ bool driver::watch_fds(detail::fd_batch& batch, duration timeout) {
     // Ensure pollfd if we are asked to block before any fd registrations
     (void) pollfd();
 
-#if COTAMER_USE_KQUEUE || COTAMER_USE_EPOLL
+#if COTAMER_USE_KQUEUE
     wakefd_.store(pollfd_, std::memory_order_seq_cst);
+#elif COTAMER_USE_EPOLL
+    wakefd_.store(epoll_wakefd_, std::memory_order_seq_cst);
+#endif
+#if COTAMER_USE_KQUEUE || COTAMER_USE_EPOLL
     if (lock_.load(std::memory_order_seq_cst)) {
         timeout = duration::zero();
     }
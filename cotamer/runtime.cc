@@ -0,0 +1,183 @@
+#include "cotamer/runtime.hh"
+#include <algorithm>
+#if defined(__linux__)
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+namespace cotamer {
+
+namespace {
+
+// Keep the current driver's loop running until `e` triggers.
+task<> hold_until(event e) {
+    driver_guard guard;
+    co_await e;
+}
+
+// Pin the current thread to CPU `cpu`. Pinning is best-effort: failures,
+// and platforms without thread affinity, are ignored.
+void pin_thread(unsigned cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % std::max(std::thread::hardware_concurrency(), 1U), &set);
+    (void) pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void) cpu;
+#endif
+}
+
+}
+
+
+runtime::runtime(unsigned nthreads, bool pin)
+    : n_(nthreads ? nthreads : std::max(std::thread::hardware_concurrency(), 1U)),
+      workers_(new detail::runtime_worker[n_]) {
+    std::latch ready(n_);
+    for (unsigned i = 0; i != n_; ++i) {
+        auto& w = workers_[i];
+        w.rt = this;
+        w.index = i;
+        w.thread = std::thread([this, &w, pin, &ready] {
+            run(w, pin, ready);
+        });
+    }
+    ready.wait();
+}
+
+runtime::~runtime() {
+    stop();
+}
+
+void runtime::run(detail::runtime_worker& w, bool pin, std::latch& ready) {
+    if (pin) {
+        pin_thread(w.index);
+    }
+    driver& d = *driver::current;
+    d.set_clock(clock::real_time);
+    d.worker_ = &w;
+    w.drv = &d;
+    hold_until(w.stop).detach();
+    ready.count_down();
+    d.loop();
+    d.worker_ = nullptr;
+    // `stop()` may still be waking this driver, which must outlive that
+    released_.wait(false, std::memory_order_acquire);
+}
+
+void runtime::wait() {
+    std::unique_lock<std::mutex> guard(done_lock_);
+    done_cv_.wait(guard, [this] {
+        return nspawned_.load(std::memory_order_acquire) == 0;
+    });
+}
+
+void runtime::stop() {
+    if (stopped_) {
+        return;
+    }
+    wait();
+    stopped_ = true;
+    for (unsigned i = 0; i != n_; ++i) {
+        workers_[i].stop.trigger();
+    }
+    released_.store(true, std::memory_order_release);
+    released_.notify_all();
+    for (unsigned i = 0; i != n_; ++i) {
+        workers_[i].thread.join();
+    }
+}
+
+void runtime::finish_spawn() noexcept {
+    // Spawned tasks finish on worker threads, which `stop()` joins before
+    // `done_lock_` is destroyed.
+    if (nspawned_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> guard(done_lock_);
+        done_cv_.notify_all();
+    }
+}
+
+
+// work stealing
+
+void runtime::share_work(driver& d) {
+    auto& w = *d.worker_;
+    runtime* rt = w.rt;
+    if (w.idle.load(std::memory_order_relaxed)) {
+        w.idle.store(false, std::memory_order_relaxed);
+        rt->nidle_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if (w.nstealable.load(std::memory_order_seq_cst) == 0) {
+        return;
+    }
+
+    // With no thief about, run the front half of our spawned tasks here,
+    // so they make progress even if this driver never runs out of work.
+    // Each call costs only the tasks it moves.
+    if (rt->nidle_.load(std::memory_order_seq_cst) == 0) {
+        std::lock_guard<std::mutex> guard(w.lock);
+        for (size_t n = (w.stealable.size() + 1) / 2; n != 0; --n) {
+            d.asap_.push_back(std::move(w.stealable.front()));
+            w.stealable.pop_front();
+        }
+        w.nstealable.store(w.stealable.size(), std::memory_order_seq_cst);
+        return;
+    }
+
+    // Otherwise wake an idle driver to steal them. Pairs with `seek_work`:
+    // either we see its idle flag, or it sees our `nstealable`.
+    for (unsigned i = 0; i != rt->n_; ++i) {
+        auto& v = rt->workers_[i];
+        if (&v != &w && v.idle.load(std::memory_order_seq_cst)) {
+            v.drv->migrate_poke();
+            break;
+        }
+    }
+}
+
+void runtime::seek_work(driver& d) {
+    auto& w = *d.worker_;
+    runtime* rt = w.rt;
+    if (rt->steal(w) || w.idle.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // Advertise idleness, then look again, so a concurrent `share_work`
+    // cannot miss us. `share_work` clears the flag once we have work.
+    w.idle.store(true, std::memory_order_seq_cst);
+    rt->nidle_.fetch_add(1, std::memory_order_seq_cst);
+    rt->steal(w);
+}
+
+bool runtime::steal(detail::runtime_worker& self) {
+    driver& d = *self.drv;
+    // Take half of our own queued tasks first, leaving the rest for other
+    // idle drivers, then steal half of another driver's.
+    for (unsigned k = 0; k != n_; ++k) {
+        auto& v = workers_[(self.index + k) % n_];
+        if (v.nstealable.load(std::memory_order_seq_cst) == 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> guard(v.lock);
+        size_t n = (v.stealable.size() + 1) / 2;
+        for (size_t i = 0; i != n; ++i) {
+            auto eh = std::move(v.stealable.front());
+            v.stealable.pop_front();
+            if (&v == &self) {
+                d.asap_.push_back(std::move(eh));
+            } else if (eh->rehome_listener(v.drv, &d)) {
+                COTAMER_STAT_INCR(tasks_stolen);
+                d.asap_.push_back(std::move(eh));
+            } else {
+                v.drv->migrate_asap(std::move(eh));
+            }
+        }
+        v.nstealable.store(v.stealable.size(), std::memory_order_seq_cst);
+        if (!d.asap_.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include "cotamer/cotamer.hh"
+#include <condition_variable>
+#include <deque>
+#include <latch>
+#include <mutex>
+#include <thread>
+
+// cotamer/runtime.hh
+//    A multi-threaded Cotamer runtime: one driver per thread, with work
+//    stealing among them.
+
+namespace cotamer {
+
+// runtime
+//    Starts `nthreads` threads (default: one per hardware thread), each
+//    running its own real-time driver, optionally pinned to a CPU. Tasks
+//    started with `spawn()` run on some runtime driver: `spawn(i, f)`
+//    targets driver `i`, while `spawn(f)` picks the calling driver, if it
+//    belongs to this runtime, or the next driver in round-robin order.
+//    `f` is a callable returning a task; it is called on the chosen driver.
+//
+//    Spawned tasks wait on their driver's stealable queue until they first
+//    run. A driver runs its own queued tasks once it has nothing else to
+//    do; while no driver is idle, a busy driver also moves the front half
+//    of them to its ASAP queue on each loop iteration. Idle drivers steal
+//    half of a busy driver's queue. A stolen task has not run yet, so it
+//    cannot have created other tasks or be awaited by one; its home driver
+//    is simply rebound to the thief. Once a task starts it stays on its
+//    driver, as do the tasks it creates.
+//
+//    `wait()` blocks until every spawned task has completed. The destructor
+//    (or `stop()`) waits, then stops and joins the threads. Call them from
+//    outside the runtime.
+
+namespace detail {
+struct runtime_worker {
+    runtime* rt;
+    unsigned index;
+    driver* drv = nullptr;                 // set by the worker's thread
+    event stop;                            // releases the thread's driver
+    std::thread thread;
+    std::atomic<bool> idle = false;        // advertised as out of work
+    std::mutex lock;                       // protects `stealable`
+    std::deque<event_handle> stealable;    // spawned tasks not yet started
+    std::atomic<size_t> nstealable = 0;
+};
+
+struct runtime_started_awaiter {
+    bool await_ready() noexcept {
+        return false;
+    }
+    bool await_suspend(std::coroutine_handle<task_promise<void>> self) noexcept {
+        self.promise().stealable_ = false;
+        return false;
+    }
+    void await_resume() noexcept {
+    }
+};
+}
+
+class runtime {
+public:
+    explicit runtime(unsigned nthreads = 0, bool pin = false);
+    ~runtime();
+    runtime(const runtime&) = delete;
+    runtime(runtime&&) = delete;
+    runtime& operator=(const runtime&) = delete;
+    runtime& operator=(runtime&&) = delete;
+
+    inline unsigned size() const noexcept;
+
+    template <typename F>
+    inline void spawn(F&& f);
+    template <typename F>
+    inline void spawn(unsigned i, F&& f);
+
+    void wait();
+    void stop();
+
+private:
+    friend class driver;
+
+    unsigned n_;
+    std::unique_ptr<detail::runtime_worker[]> workers_;
+    std::atomic<unsigned> next_ = 0;       // next round-robin driver
+    std::atomic<unsigned> nidle_ = 0;      // number of idle workers
+    std::atomic<size_t> nspawned_ = 0;     // spawned tasks not yet complete
+    std::mutex done_lock_;
+    std::condition_variable done_cv_;
+    bool stopped_ = false;
+    std::atomic<bool> released_ = false;   // set once stop() has woken everyone
+
+    struct spawn_guard {
+        runtime* rt;
+        ~spawn_guard() {
+            rt->finish_spawn();
+        }
+    };
+
+    template <typename F>
+    static task<> launch(runtime* rt, event start, F f);
+    void finish_spawn() noexcept;
+    void run(detail::runtime_worker& w, bool pin, std::latch& ready);
+    bool steal(detail::runtime_worker& self);
+
+    // Hooks called by a runtime driver's loop.
+    static void share_work(driver& d);
+    static void seek_work(driver& d);
+};
+
+
+inline unsigned runtime::size() const noexcept {
+    return n_;
+}
+
+template <typename F>
+inline void runtime::spawn(F&& f) {
+    auto* w = driver::current->worker_;
+    unsigned i = w && w->rt == this
+        ? w->index
+        : next_.fetch_add(1, std::memory_order_relaxed) % n_;
+    spawn(i, std::forward<F>(f));
+}
+
+template <typename F>
+inline void runtime::spawn(unsigned i, F&& f) {
+    assert(i < n_);
+    nspawned_.fetch_add(1, std::memory_order_relaxed);
+    // The launcher suspends on `start` before doing anything, so it is safe
+    // to give it a new home. `start` is queued on that driver's stealable
+    // queue, where idle drivers can find it without scanning ASAP queues.
+    event start;
+    task<> t = launch<std::decay_t<F>>(this, start, std::forward<F>(f));
+    auto& p = t.handle_.promise();
+    auto& w = workers_[i];
+    p.home_ = w.drv;
+    p.stealable_ = true;
+    t.detach();
+    detail::event_handle eh = start.handle();
+    eh->trigger_held();
+    {
+        std::lock_guard<std::mutex> guard(w.lock);
+        w.stealable.push_back(std::move(eh));
+        w.nstealable.store(w.stealable.size(), std::memory_order_seq_cst);
+    }
+    if (driver::current.get() != w.drv) {
+        w.drv->migrate_poke();
+    }
+}
+
+template <typename F>
+task<> runtime::launch(runtime* rt, event start, F f) {
+    spawn_guard guard{rt};
+    co_await start;
+    co_await detail::runtime_started_awaiter{};
+    co_await f();
+}
+
+}
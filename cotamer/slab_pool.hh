@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// slab_pool.hh
+//    Defines cotamer::detail::slab_pool, the per-driver allocator for event
+//    bodies. Blocks are carved from 16 KiB slabs, one size class per body
+//    type. Each block starts with a pointer to its owning pool.
+//
+//    Only the owning driver's thread allocates from a pool or pushes onto
+//    its local free lists. Other threads return blocks through `remote_`,
+//    a lock-free stack the owner drains when a local list runs dry. When
+//    the driver is destroyed, the pool is *orphaned*: it lives on until
+//    every outstanding block has been freed, then frees itself.
+
+namespace cotamer {
+namespace detail {
+
+class slab_pool {
+public:
+    static constexpr unsigned nclasses = 2;
+    static constexpr size_t slab_size = 16 << 10;
+    static constexpr size_t header_size = sizeof(slab_pool*);
+
+    slab_pool() = default;
+    slab_pool(const slab_pool&) = delete;
+    slab_pool(slab_pool&&) = delete;
+    slab_pool& operator=(const slab_pool&) = delete;
+    slab_pool& operator=(slab_pool&&) = delete;
+
+    // Pop a free block of class `cls`, or return nullptr.
+    inline void* pop(unsigned cls) noexcept;
+    // Carve a new block of class `cls`; `size` excludes the header.
+    inline void* carve(unsigned cls, size_t size);
+    // Allocate a block owned by no pool, for threads without a driver.
+    static void* allocate_unowned(size_t size);
+    // Free block `ptr` of class `cls`. `current` is the freeing thread's
+    // pool. Returns true if the block went back through a remote path.
+    static inline bool free(void* ptr, unsigned cls, slab_pool* current) noexcept;
+
+    // Deleter for the owning driver's reference.
+    struct orphan_deleter {
+        void operator()(slab_pool* p) const noexcept {
+            p->orphan();
+        }
+    };
+
+private:
+    struct free_block {
+        free_block* next;
+        unsigned cls;
+    };
+
+    static constexpr uintptr_t remote_orphaned = 1;
+
+    free_block* free_[nclasses] = {};
+    char* bump_[nclasses] = {};
+    char* bump_end_[nclasses] = {};
+    size_t ncarved_ = 0;                     // blocks carved from slabs
+    size_t nfree_ = 0;                       // blocks on `free_` lists
+    std::vector<void*> slabs_;
+    std::atomic<uintptr_t> remote_ = 0;      // remote free stack | orphaned
+    std::atomic<ptrdiff_t> orphan_live_ = 0; // outstanding blocks once orphaned
+
+    ~slab_pool();
+    void* hard_carve(unsigned cls, size_t size);
+    void drain_remote() noexcept;
+    void remote_free(free_block* fb) noexcept;
+    void orphan() noexcept;
+
+    static slab_pool*& owner(void* block) noexcept {
+        return *static_cast<slab_pool**>(block);
+    }
+};
+
+
+inline void* slab_pool::pop(unsigned cls) noexcept {
+    free_block* fb = free_[cls];
+    if (!fb && remote_.load(std::memory_order_relaxed) != 0) {
+        drain_remote();
+        fb = free_[cls];
+    }
+    if (!fb) {
+        return nullptr;
+    }
+    free_[cls] = fb->next;
+    --nfree_;
+    owner(fb) = this;
+    return reinterpret_cast<char*>(fb) + header_size;
+}
+
+inline void* slab_pool::carve(unsigned cls, size_t size) {
+    size_t bsize = (header_size + size + alignof(free_block) - 1) & ~(alignof(free_block) - 1);
+    bsize = bsize < sizeof(free_block) ? sizeof(free_block) : bsize;
+    if (size_t(bump_end_[cls] - bump_[cls]) < bsize) {
+        return hard_carve(cls, bsize);
+    }
+    char* block = bump_[cls];
+    bump_[cls] += bsize;
+    ++ncarved_;
+    owner(block) = this;
+    return block + header_size;
+}
+
+inline bool slab_pool::free(void* ptr, unsigned cls, slab_pool* current) noexcept {
+    char* block = static_cast<char*>(ptr) - header_size;
+    slab_pool* p = owner(block);
+    if (!p) {
+        ::operator delete(block);
+        return false;
+    }
+    auto* fb = new (block) free_block{nullptr, cls};
+    if (p == current) {
+        fb->next = p->free_[cls];
+        p->free_[cls] = fb;
+        ++p->nfree_;
+        return false;
+    }
+    p->remote_free(fb);
+    return true;
+}
+
+}
+}
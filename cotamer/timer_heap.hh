@@ -1,6 +1,7 @@
 #pragma once
 #include "cotamer/circular_int.hh"
 #include <chrono>
+#include <utility>
 
 template <typename T>
 struct timer_heap_traits {
@@ -11,6 +12,12 @@ struct timer_heap_traits {
     };
     using time_point_type = std::chrono::steady_clock::time_point;
     static constexpr int arity = 4;
+    // Record `x`'s position, if `T` wants to know, so it can be erased.
+    static void set_position(T& x, unsigned pos) noexcept {
+        if constexpr (requires { x.set_timer_position(pos); }) {
+            x.set_timer_position(pos);
+        }
+    }
 };
 
 template <typename T>
@@ -22,6 +29,7 @@ struct timer_heap {
     using value_type = T;
     using reference = T&;
     using size_type = unsigned;
+    static constexpr unsigned npos = -1;
     static_assert(arity >= 2);
 
     timer_heap() = default;
@@ -41,6 +49,10 @@ struct timer_heap {
     inline void cull();
     void clear();
 
+    // Positions are reported through `traits_type::set_position`.
+    inline T* at_position(unsigned pos) noexcept;
+    inline void erase(unsigned pos);
+
   private:
     struct element {
         time_point_type when;
@@ -59,6 +71,7 @@ struct timer_heap {
     static inline unsigned heap_parent(unsigned i) noexcept;
     static inline unsigned heap_first_child(unsigned i) noexcept;
     inline unsigned heap_last_child(unsigned i) const noexcept;
+    inline void set_position(unsigned pos) noexcept;
     void hard_cull(unsigned pos);
     void expand();
 };
@@ -66,7 +79,7 @@ struct timer_heap {
 
 template <typename T>
 inline timer_heap<T>::~timer_heap() {
-    std::destroy_n(es_, size_);
+    clear();
     std::allocator<element> alloc;
     alloc.deallocate(es_, capacity_);
 }
@@ -133,10 +146,27 @@ inline void timer_heap<T>::pop() {
     hard_cull(0);
 }
 
+template <typename T>
+inline T* timer_heap<T>::at_position(unsigned pos) noexcept {
+    return pos < size_ ? &es_[pos].value : nullptr;
+}
+
+template <typename T>
+inline void timer_heap<T>::erase(unsigned pos) {
+    hard_cull(pos);
+}
+
+template <typename T>
+inline void timer_heap<T>::set_position(unsigned pos) noexcept {
+    traits_type::set_position(es_[pos].value, pos);
+}
+
 template <typename T>
 void timer_heap<T>::clear() {
-    std::destroy_n(es_, size_);
-    size_ = 0;
+    // Empty the heap before destroying elements, since destroying one may
+    // look up another's position.
+    unsigned n = std::exchange(size_, 0);
+    std::destroy_n(es_, n);
 }
 
 template <typename T>
@@ -185,8 +215,10 @@ void timer_heap<T>::emplace(time_point_type when, T&& value) {
             break;
         }
         swap(es_[pos], es_[p]);
+        set_position(pos);
         pos = p;
     }
+    set_position(pos);
 }
 
 template <typename T>
@@ -195,6 +227,7 @@ void timer_heap<T>::hard_cull(unsigned pos) {
     assert(size_ != 0);
 
     --size_;
+    traits_type::set_position(es_[pos].value, npos);
     if (pos == size_) {
         std::destroy_at(es_ + pos);
         return;
@@ -216,13 +249,16 @@ void timer_heap<T>::hard_cull(unsigned pos) {
                 break;
             }
             swap(es_[pos], es_[smallest]);
+            set_position(pos);
             pos = smallest;
         }
     } else {
         do {
             unsigned p = heap_parent(pos);
             swap(es_[pos], es_[p]);
+            set_position(pos);
             pos = p;
         } while (pos && es_[pos] < es_[heap_parent(pos)]);
     }
+    set_position(pos);
 }
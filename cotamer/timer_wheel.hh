@@ -0,0 +1,340 @@
+#pragma once
+#include "cotamer/circular_int.hh"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// timer_wheel.hh
+//    A hierarchical timing wheel with the same interface and ordering as
+//    timer_heap. Time is divided into ticks of 2^`tick_shift` ns; level L
+//    has 64 slots of 64^L ticks each. Insertion appends to a slot in O(1).
+//    The wheel keeps a *cursor* tick: no timer is earlier than it except
+//    those in `ready_`. When `ready_` is empty, the cursor jumps to the next
+//    occupied slot (found with per-level bitmaps), and that slot's timers
+//    move to a lower level or, once their tick is the cursor, to `ready_`.
+//
+//    `ready_` is a small binary heap ordered by time and then insertion
+//    order (a circular_int stamp, as in timer_heap), so timers with equal
+//    times fire in FIFO order however they travelled through the levels.
+
+template <typename T>
+struct timer_wheel_traits {
+    struct empty_type {
+        bool operator()(const T& x) const {
+            return x.empty();
+        }
+    };
+    using time_point_type = std::chrono::steady_clock::time_point;
+    static constexpr int tick_shift = 16;   // 65.536 µs
+    // Record `x`'s position, if `T` wants to know, so it can be erased.
+    static void set_position(T& x, unsigned pos) noexcept {
+        if constexpr (requires { x.set_timer_position(pos); }) {
+            x.set_timer_position(pos);
+        }
+    }
+};
+
+template <typename T>
+struct timer_wheel {
+    using traits_type = timer_wheel_traits<T>;
+    using empty_type = typename traits_type::empty_type;
+    using time_point_type = typename traits_type::time_point_type;
+    using value_type = T;
+    using reference = T&;
+    using size_type = unsigned;
+    static constexpr int tick_shift = traits_type::tick_shift;
+    static constexpr int level_bits = 6;
+    static constexpr unsigned nslots = 1U << level_bits;
+    static constexpr int nlevels = (64 - tick_shift + level_bits - 1) / level_bits;
+    static constexpr unsigned npos = -1;
+
+    timer_wheel() = default;
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel(timer_wheel&&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+    timer_wheel& operator=(timer_wheel&&) = delete;
+    inline ~timer_wheel();
+
+    inline bool empty() const noexcept;
+    inline unsigned size() const noexcept;
+    inline time_point_type top_time();
+    inline T& top() &;
+    void emplace(time_point_type t, T&& value);
+    inline void pop();
+    inline void cull();
+    void clear();
+
+    // Positions are reported through `traits_type::set_position`.
+    inline T* at_position(unsigned pos) noexcept;
+    void erase(unsigned pos);
+
+  private:
+    struct element {
+        time_point_type when;
+        circular_int<unsigned> order;
+        value_type value;
+
+        inline bool operator<(const element &x) const noexcept;
+    };
+
+    // A position is `where << index_bits | index`, where `where` is 0 for
+    // `ready_` and 1 + the slot number otherwise. Timers at indexes too
+    // large to encode get `npos` and can only be culled.
+    static constexpr int index_bits = 22;
+    std::vector<element> ready_;                  // heap of timers at or before cursor
+    std::vector<element> slots_[nlevels][nslots];
+    uint64_t occupied_[nlevels] = {};             // bitmap of nonempty slots
+    uint64_t cursor_ = 0;                         // current tick
+    unsigned size_ = 0;
+    unsigned order_ = 0;                          // next `order` to insert
+
+    static inline uint64_t tick(time_point_type t) noexcept;
+    void place(element&& e);
+    inline void settle();
+    void advance();
+    static inline unsigned position(unsigned where, size_t index) noexcept;
+    inline std::vector<element>& slot_vector(unsigned where) noexcept;
+    void ready_sift_up(size_t i);
+    void ready_sift_down(size_t i);
+};
+
+
+template <typename T>
+inline timer_wheel<T>::~timer_wheel() {
+    clear();
+}
+
+template <typename T>
+inline bool timer_wheel<T>::empty() const noexcept {
+    return size_ == 0;
+}
+
+template <typename T>
+inline unsigned timer_wheel<T>::size() const noexcept {
+    return size_;
+}
+
+template <typename T>
+inline auto timer_wheel<T>::top_time() -> time_point_type {
+    settle();
+    return ready_.front().when;
+}
+
+template <typename T>
+inline T& timer_wheel<T>::top() & {
+    settle();
+    return ready_.front().value;
+}
+
+template <typename T>
+inline void timer_wheel<T>::pop() {
+    settle();
+    erase(0);
+}
+
+template <typename T>
+inline void timer_wheel<T>::cull() {
+    while (size_ != 0) {
+        settle();
+        if (!empty_type{}(ready_.front().value)) {
+            break;
+        }
+        pop();
+    }
+}
+
+template <typename T>
+inline bool timer_wheel<T>::element::operator<(const element &x) const noexcept {
+    auto cmp = when <=> x.when;
+    return cmp < 0 || (cmp == 0 && order < x.order);
+}
+
+template <typename T>
+inline unsigned timer_wheel<T>::position(unsigned where, size_t index) noexcept {
+    return index < (size_t(1) << index_bits) ? (where << index_bits) | index : npos;
+}
+
+template <typename T>
+inline auto timer_wheel<T>::slot_vector(unsigned where) noexcept -> std::vector<element>& {
+    return slots_[(where - 1) / nslots][(where - 1) % nslots];
+}
+
+template <typename T>
+inline T* timer_wheel<T>::at_position(unsigned pos) noexcept {
+    unsigned where = pos >> index_bits;
+    size_t index = pos & ((1U << index_bits) - 1);
+    if (where > nlevels * nslots) {
+        return nullptr;
+    }
+    auto& v = where == 0 ? ready_ : slot_vector(where);
+    return index < v.size() ? &v[index].value : nullptr;
+}
+
+template <typename T>
+void timer_wheel<T>::erase(unsigned pos) {
+    unsigned where = pos >> index_bits;
+    size_t index = pos & ((1U << index_bits) - 1);
+    auto& v = where == 0 ? ready_ : slot_vector(where);
+    assert(index < v.size());
+    traits_type::set_position(v[index].value, npos);
+    --size_;
+    if (index == v.size() - 1) {
+        v.pop_back();
+    } else {
+        v[index] = std::move(v.back());
+        v.pop_back();
+        if (where == 0) {
+            ready_sift_up(index);
+            ready_sift_down(index);
+        } else {
+            traits_type::set_position(v[index].value, pos);
+        }
+    }
+    if (where != 0 && v.empty()) {
+        unsigned w = where - 1;
+        occupied_[w / nslots] &= ~(uint64_t(1) << (w % nslots));
+    }
+}
+
+template <typename T>
+void timer_wheel<T>::ready_sift_up(size_t i) {
+    using std::swap;
+    while (i != 0) {
+        size_t p = (i - 1) / 2;
+        if (!(ready_[i] < ready_[p])) {
+            break;
+        }
+        swap(ready_[i], ready_[p]);
+        traits_type::set_position(ready_[i].value, position(0, i));
+        i = p;
+    }
+    traits_type::set_position(ready_[i].value, position(0, i));
+}
+
+template <typename T>
+void timer_wheel<T>::ready_sift_down(size_t i) {
+    using std::swap;
+    while (true) {
+        size_t smallest = i, c = 2 * i + 1;
+        if (c < ready_.size() && ready_[c] < ready_[smallest]) {
+            smallest = c;
+        }
+        if (c + 1 < ready_.size() && ready_[c + 1] < ready_[smallest]) {
+            smallest = c + 1;
+        }
+        if (smallest == i) {
+            break;
+        }
+        swap(ready_[i], ready_[smallest]);
+        traits_type::set_position(ready_[i].value, position(0, i));
+        i = smallest;
+    }
+    traits_type::set_position(ready_[i].value, position(0, i));
+}
+
+template <typename T>
+inline uint64_t timer_wheel<T>::tick(time_point_type t) noexcept {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    return ns > 0 ? uint64_t(ns) >> tick_shift : 0;
+}
+
+template <typename T>
+inline void timer_wheel<T>::settle() {
+    assert(size_ != 0);
+    if (ready_.empty()) {
+        advance();
+    }
+}
+
+template <typename T>
+void timer_wheel<T>::clear() {
+    // Forget every position before destroying elements, since destroying
+    // one may look up another's position.
+    std::vector<element> dead;
+    dead.swap(ready_);
+    for (int l = 0; l != nlevels; ++l) {
+        for (uint64_t occ = occupied_[l]; occ != 0; occ &= occ - 1) {
+            auto& sv = slots_[l][std::countr_zero(occ)];
+            std::move(sv.begin(), sv.end(), std::back_inserter(dead));
+            sv.clear();
+        }
+        occupied_[l] = 0;
+    }
+    size_ = 0;
+    for (auto& e : dead) {
+        traits_type::set_position(e.value, npos);
+    }
+}
+
+template <typename T>
+void timer_wheel<T>::emplace(time_point_type when, T&& value) {
+    place(element{when, ++order_, std::move(value)});
+    ++size_;
+}
+
+template <typename T>
+void timer_wheel<T>::place(element&& e) {
+    uint64_t t = tick(e.when);
+    if (t <= cursor_) {
+        ready_.push_back(std::move(e));
+        ready_sift_up(ready_.size() - 1);
+        return;
+    }
+    // The level is the one holding the highest tick bit that differs from
+    // the cursor; within it, the slot index is greater than the cursor's.
+    int level = (std::bit_width(t ^ cursor_) - 1) / level_bits;
+    unsigned slot = (t >> (level * level_bits)) & (nslots - 1);
+    unsigned where = 1 + level * nslots + slot;
+    auto& sv = slots_[level][slot];
+    // Before a largish slot grows, drop its dead timers. This keeps the
+    // wheel small even if many timers are abandoned before they fire.
+    if (sv.size() >= 32 && sv.size() == sv.capacity()) {
+        size_ -= std::erase_if(sv, [] (const element& x) {
+            return empty_type{}(x.value);
+        });
+        for (size_t i = 0; i != sv.size(); ++i) {
+            traits_type::set_position(sv[i].value, position(where, i));
+        }
+    }
+    sv.push_back(std::move(e));
+    traits_type::set_position(sv.back().value, position(where, sv.size() - 1));
+    occupied_[level] |= uint64_t(1) << slot;
+}
+
+template <typename T>
+void timer_wheel<T>::advance() {
+    // Called when `ready_` is empty and `size_ != 0`. Find the lowest level
+    // with an occupied slot after the cursor's, move the cursor to the
+    // start of that slot, and redistribute its timers. Repeat until some
+    // timer reaches `ready_`.
+    while (ready_.empty()) {
+        int level = 0;
+        uint64_t occ = 0;
+        for (; level != nlevels; ++level) {
+            unsigned idx = (cursor_ >> (level * level_bits)) & (nslots - 1);
+            occ = occupied_[level] & ~((uint64_t(2) << idx) - 1);
+            if (occ != 0) {
+                break;
+            }
+        }
+        assert(level != nlevels);
+        unsigned slot = std::countr_zero(occ);
+        int shift = level * level_bits;
+        uint64_t mask = (uint64_t(nslots) << shift) - 1;
+        cursor_ = (cursor_ & ~mask) | (uint64_t(slot) << shift);
+        occupied_[level] &= ~(uint64_t(1) << slot);
+
+        // Timers move to strictly lower levels, so the slot stays empty;
+        // give it back its buffer afterwards.
+        std::vector<element> moving;
+        moving.swap(slots_[level][slot]);
+        for (auto& e : moving) {
+            place(std::move(e));
+        }
+        moving.clear();
+        moving.swap(slots_[level][slot]);
+    }
+}
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <system_error>
+#include <unistd.h>
+#include "batching.hh"
+
+flow_controller::flow_controller(const client_options& options)
+    : _fixed_window(options.window != 0), _fixed_batch(options.batch != 0),
+      _window(options.window ? options.window : initial_window),
+      _batch(options.batch) {
+    set_batch();
+}
+
+void flow_controller::set_batch() {
+    if (!_fixed_batch) {
+        _batch = std::bit_floor(std::clamp(_window / batches_in_flight,
+                                           min_batch, max_batch));
+    }
+}
+
+// - return the expected RTT of a batch of `n` tries that does not queue
+steady_clock::duration flow_controller::unqueued_rtt(size_t n) const {
+    auto service = std::chrono::duration<double>(_max_rate ? n / _max_rate : 0);
+    return _min_rtt + std::chrono::duration_cast<steady_clock::duration>(service);
+}
+
+// - return the bandwidth-delay product in tries, or 0 if it is not yet
+//   known
+size_t flow_controller::bdp() const {
+    if (_max_rate == 0) {
+        return 0;
+    }
+    return _max_rate * std::chrono::duration<double>(unqueued_rtt(_batch)).count();
+}
+
+void flow_controller::end_round(uint64_t next_serial) {
+    if (!_skip_round && _round_excess > rtt_slack) {
+        // every batch in the round queued: multiplicative decrease
+        size_t floor = std::max(bdp(), min_window);
+        if (_window > floor) {
+            _window = std::max(_window - _window / 4, floor);
+            _ssthresh = _window;
+            _growth = 0;
+            ++_decreases;
+            // the next round's batches were sent before the decrease
+            _skip_round = true;
+        }
+    } else {
+        _skip_round = false;
+    }
+    _round_end = next_serial;
+    _round_excess = steady_clock::duration::max();
+}
+
+void flow_controller::on_response(uint64_t first_serial, size_t n,
+                                  steady_clock::duration rtt,
+                                  uint64_t next_serial) {
+    _srtt = _srtt == steady_clock::duration{} ? rtt : (_srtt * 7 + rtt) / 8;
+    _flush_deadline = std::clamp<steady_clock::duration>(
+        _srtt / 8, std::chrono::microseconds(20), std::chrono::milliseconds(1));
+
+    // delivery rate, sampled about once per round trip
+    _rate_tries += n;
+    auto now = steady_clock::now();
+    if (now - _rate_start >= _srtt && now > _rate_start) {
+        double rate = _rate_tries / std::chrono::duration<double>(now - _rate_start).count();
+        _rate = _rate == 0 ? rate : 0.75 * _rate + 0.25 * rate;
+        _max_rate = std::max(_max_rate, _rate);
+        _rate_start = now;
+        _rate_tries = 0;
+    }
+
+    if (_fixed_window) {
+        return;
+    }
+    if (first_serial >= _round_end) {
+        // first response to a batch sent after the last round ended
+        end_round(next_serial);
+    }
+    _min_rtt = std::min(_min_rtt, rtt);
+    _round_excess = std::min(_round_excess, rtt - 2 * unqueued_rtt(n));
+
+    size_t bdp = this->bdp();
+    if (bdp != 0 && _window >= 2 * bdp) {
+        // enough to keep the server busy; more would only queue
+    } else if (_window < _ssthresh) {
+        // slow start: one try per acknowledged try
+        _window = std::min(_window + n, max_window);
+    } else {
+        // additive increase: one batch per window of acknowledged tries
+        _growth += n;
+        if (_growth >= _window) {
+            _window = std::min(_window + _batch, max_window);
+            _growth = 0;
+        }
+    }
+    set_batch();
+}
+
+void flow_controller::report(std::ostream& out) const {
+    using usec = std::chrono::duration<double, std::micro>;
+    out << std::format("flow control: window {}{}, batch {}{}, smoothed RTT {:.0f} us, "
+                       "{} decreases, peak {:.0f} tries/sec\n",
+                       _window, _fixed_window ? " (fixed)" : "",
+                       _batch, _fixed_batch ? " (fixed)" : "",
+                       usec(_srtt).count(), _decreases, _max_rate);
+}
+
+batch_stream::batch_stream(const client_options& options)
+    : _flow(options), _latency_csv(options.latency_csv) {
+    _batch_buf.reserve(std::max(_flow.batch_size(), flow_controller::max_batch));
+}
+
+bool batch_stream::add_try(const char* name, size_t name_len, uint64_t count) {
+    if (_batch_buf.empty()) {
+        _batch_start = steady_clock::now();
+    }
+    _batch_buf.emplace_back(_serial, name, uint32_t(name_len),
+                            try_ref::literal, 0, count);
+    ++_serial;
+
+    return _batch_buf.size() >= _flow.batch_size()
+        || _in_flight.empty()
+        || ((_batch_buf.size() & 15) == 0
+            && steady_clock::now() - _batch_start >= _flow.flush_deadline());
+}
+
+void batch_stream::batch_sent() {
+    _in_flight.push_back({_batch_buf.front().serial, uint32_t(_batch_buf.size()),
+                          _batch_start, steady_clock::now()});
+    _in_flight_tries += _batch_buf.size();
+    _batch_buf.clear();
+}
+
+auto batch_stream::expect_response(uint64_t serial_base, size_t n)
+    -> const in_flight_batch& {
+    if (_in_flight.empty()
+        || _in_flight.front().first_serial != serial_base
+        || _in_flight.front().n != n) {
+        throw std::runtime_error("unexpected try response");
+    }
+    return _in_flight.front();
+}
+
+void batch_stream::batch_answered(steady_clock::time_point arrived) {
+    const in_flight_batch& b = _in_flight.front();
+    auto rtt = arrived - b.sent;
+    _flow.on_response(b.first_serial, b.n, rtt, _serial);
+    _latency.batch_rtt.record(rtt);
+    _latency.try_latency.record(steady_clock::now() - b.opened, b.n);
+    _in_flight_tries -= b.n;
+    _in_flight.pop_front();
+}
+
+bool batch_stream::write_some(int fd) {
+    if (_out_pos == _out.size()) {
+        return false;
+    }
+    ssize_t nw = ::write(fd, _out.data() + _out_pos, _out.size() - _out_pos);
+    if (nw < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return false;
+    } else if (nw < 0) {
+        throw std::system_error(errno, std::generic_category());
+    }
+    _out_pos += nw;
+    if (_out_pos == _out.size()) {
+        _out.clear();
+        _out_pos = 0;
+    }
+    return nw > 0;
+}
+
+void batch_stream::report(const std::string& server_client_checksum,
+                          const std::string& server_server_checksum) const {
+    report_checksums(server_client_checksum, server_server_checksum);
+    _flow.report(std::cerr);
+    _latency.report(std::cerr, _latency_csv);
+}
+
+void report_checksums(const std::string& server_client_checksum,
+                      const std::string& server_server_checksum) {
+    const std::string& my_client_checksum = client_checksum(),
+        my_server_checksum = server_checksum();
+    bool ok = my_client_checksum == server_client_checksum
+        && my_server_checksum == server_server_checksum;
+    std::cout << "client checksums: "
+        << my_client_checksum << "/" << server_client_checksum
+        << "\nserver checksums: "
+        << my_server_checksum << "/" << server_server_checksum
+        << "\nmatch: " << (ok ? "true\n" : "false\n");
+}
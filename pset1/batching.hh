@@ -0,0 +1,264 @@
+#ifndef CS2620_PSET1_BATCHING_HH
+#define CS2620_PSET1_BATCHING_HH
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "latency.hh"
+#include "rpcgame.hh"
+
+// Client-side batching machinery shared by the client transports.
+
+using steady_clock = std::chrono::steady_clock;
+
+
+// A buffered try. `name` points into the caller's input, which outlives the
+// client, so names are never copied until they are packed.
+//
+// With the `dict` encoding, a try may instead refer to its name by a
+// per-session ID. The first try with a name defines the ID; later tries use
+// it once the server has acknowledged the definition.
+struct try_ref {
+    enum kind_type : uint8_t {
+        literal,        // (serial, name, count)
+        define,         // (serial, name, count, id)
+        reference       // (serial, id, count)
+    };
+
+    uint64_t serial;
+    const char* name;
+    uint32_t name_len;
+    kind_type kind;
+    uint32_t name_id;
+    uint64_t count;
+};
+
+
+// A FIFO queue in a power-of-two ring that grows as needed.
+template <typename T>
+class ring_queue {
+public:
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+    T& front() { return _slots[_head]; }
+    T& operator[](size_t i) { return _slots[(_head + i) & (_slots.size() - 1)]; }
+
+    void push_back(T x) {
+        if (_size == _slots.size()) {
+            grow();
+        }
+        _slots[(_head + _size) & (_slots.size() - 1)] = std::move(x);
+        ++_size;
+    }
+
+    void pop_front() {
+        _slots[_head] = T();
+        _head = (_head + 1) & (_slots.size() - 1);
+        --_size;
+    }
+
+private:
+    std::vector<T> _slots;
+    size_t _head = 0;
+    size_t _size = 0;
+
+    void grow() {
+        std::vector<T> slots(std::max(_slots.size() * 2, size_t(16)));
+        for (size_t i = 0; i != _size; ++i) {
+            slots[i] = std::move(_slots[(_head + i) & (_slots.size() - 1)]);
+        }
+        _slots.swap(slots);
+        _head = 0;
+    }
+};
+
+
+// In-order delivery of responses. Values land in a ring indexed by
+// `serial % capacity`, tagged with their serial and arrival time;
+// `deliver` passes the contiguous prefix to `client_recv_try_response` and
+// records, per try, how long it waited after arriving for the tries before
+// it. At most `capacity` tries may be undelivered at once.
+class reorder_window {
+public:
+    explicit reorder_window(size_t capacity)
+        : _mask(std::bit_ceil(capacity) - 1),
+          _serials(_mask + 1, 0), _values(_mask + 1), _arrived(_mask + 1) {
+    }
+
+    uint64_t next_serial() const { return _next; }
+
+    void put(uint64_t serial, uint64_t value, steady_clock::time_point arrived) {
+        assert(serial >= _next && serial - _next <= _mask);
+        _serials[serial & _mask] = serial;
+        _values[serial & _mask] = value;
+        _arrived[serial & _mask] = arrived;
+    }
+
+    void deliver(latency_histogram& reorder_wait) {
+        // tries from one response share an arrival time, so record runs
+        auto now = steady_clock::now();
+        steady_clock::time_point run_arrived;
+        uint64_t run = 0;
+        while (_serials[_next & _mask] == _next) {
+            client_recv_try_response(_values[_next & _mask]);
+            if (run != 0 && _arrived[_next & _mask] != run_arrived) {
+                reorder_wait.record(now - run_arrived, run);
+                run = 0;
+            }
+            run_arrived = _arrived[_next & _mask];
+            ++run;
+            ++_next;
+        }
+        if (run != 0) {
+            reorder_wait.record(now - run_arrived, run);
+        }
+    }
+
+private:
+    uint64_t _mask;
+    uint64_t _next = 1;
+    std::vector<uint64_t> _serials;   // serial 0 is never used, so 0 = empty
+    std::vector<uint64_t> _values;
+    std::vector<steady_clock::time_point> _arrived;
+};
+
+
+// Adaptive flow control.
+//
+// The window (the maximum number of in-flight tries) starts at
+// `initial_window` and doubles every round trip, then grows by one batch
+// per round trip. The batch size follows the window so that about
+// `batches_in_flight` batches are outstanding.
+//
+// Without queueing, a batch of `n` tries should take about the minimum
+// RTT plus `n` divided by the peak delivery rate. Once per round trip,
+// if every response in the round took more than twice that plus
+// `rtt_slack`, batches are queueing at the server and the window shrinks
+// by 1/4. Judging a whole round, with absolute slack, ignores jitter in
+// single samples. The window never shrinks below the bandwidth-delay
+// product (the peak rate times the unqueued RTT of a batch), which is
+// what keeps the server busy, and stops growing at twice that.
+//
+// A nonzero `window` or `batch` option fixes that parameter instead.
+class flow_controller {
+public:
+    static constexpr size_t min_window = 16;
+    static constexpr size_t max_window = 1 << 16;
+    static constexpr size_t initial_window = 4096;
+    static constexpr size_t min_batch = 1;
+    static constexpr size_t max_batch = 1 << 13;
+    static constexpr size_t batches_in_flight = 2;
+    static constexpr steady_clock::duration rtt_slack = std::chrono::microseconds(100);
+
+    explicit flow_controller(const client_options& options);
+
+    size_t window() const { return _window; }
+    size_t batch_size() const { return _batch; }
+    // A partial batch older than this is sent anyway
+    steady_clock::duration flush_deadline() const { return _flush_deadline; }
+
+    void on_response(uint64_t first_serial, size_t n,
+                     steady_clock::duration rtt, uint64_t next_serial);
+    void report(std::ostream& out) const;
+
+private:
+    bool _fixed_window;
+    bool _fixed_batch;
+    size_t _window;
+    size_t _batch;
+    size_t _ssthresh = max_window;
+    size_t _growth = 0;               // tries acknowledged since last increase
+    uint64_t _round_end = 0;          // first serial sent after this round
+    steady_clock::duration _round_excess = steady_clock::duration::max();
+    bool _skip_round = true;          // round's batches predate a decrease
+    steady_clock::duration _min_rtt = steady_clock::duration::max();
+    steady_clock::duration _srtt{};
+    steady_clock::duration _flush_deadline = std::chrono::microseconds(200);
+    steady_clock::time_point _rate_start = steady_clock::now();
+    size_t _rate_tries = 0;
+    double _rate = 0;                 // smoothed tries/sec
+    double _max_rate = 0;
+    size_t _decreases = 0;
+
+    steady_clock::duration unqueued_rtt(size_t n) const;
+    size_t bdp() const;
+    void end_round(uint64_t next_serial);
+    void set_batch();
+};
+
+
+// Client state shared by the stream transports (cotamer and protobuf),
+// which send every batch on one connection and get responses in order:
+// the batch being built, the output not yet written, and the batches
+// awaiting responses. A transport encodes `_batch_buf` into `_out` and
+// calls `batch_sent`; for each response, it calls `expect_response`,
+// delivers the values, and calls `batch_answered`.
+class batch_stream {
+public:
+    struct in_flight_batch {
+        uint64_t first_serial = 0;
+        uint32_t n = 0;
+        steady_clock::time_point opened;    // first try was buffered
+        steady_clock::time_point sent;
+    };
+
+    explicit batch_stream(const client_options& options);
+
+    bool window_open() const {
+        return _in_flight_tries < _flow.window()
+            && _in_flight.size() < max_batches_in_flight;
+    }
+    bool drained() const {
+        return _in_flight.empty();
+    }
+    bool output_pending() const {
+        return _out_pos != _out.size();
+    }
+
+protected:
+    flow_controller _flow;
+    latency_recorder _latency;
+    std::string _latency_csv;
+    uint64_t _serial = 1;
+
+    std::vector<try_ref> _batch_buf;
+    steady_clock::time_point _batch_start;
+
+    std::string _out;                   // frames not yet written
+    size_t _out_pos = 0;
+
+    ring_queue<in_flight_batch> _in_flight;
+    size_t _in_flight_tries = 0;
+
+    // - buffer a try; return true if the batch should be sent now
+    bool add_try(const char* name, size_t name_len, uint64_t count);
+    // - record the batch in `_batch_buf`, now encoded in `_out`, as sent
+    void batch_sent();
+    // - return the oldest in-flight batch, checking that a response for
+    //   `n` tries from `serial_base` answers it
+    const in_flight_batch& expect_response(uint64_t serial_base, size_t n);
+    // - retire the oldest in-flight batch, whose response arrived at
+    //   `arrived` and whose values have been delivered
+    void batch_answered(steady_clock::time_point arrived);
+
+    // - write pending output to nonblocking `fd`; return true if anything
+    //   was written
+    bool write_some(int fd);
+
+    // - print checksums, flow control state, and latencies
+    void report(const std::string& server_client_checksum,
+                const std::string& server_server_checksum) const;
+};
+
+
+// - compare the server's checksums with ours and print the result
+void report_checksums(const std::string& server_client_checksum,
+                      const std::string& server_server_checksum);
+
+#endif
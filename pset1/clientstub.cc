@@ -1,40 +1,132 @@
 #include <rpc/client.h>
 
-#include <chrono>
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <future>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
-#include "rpcgame.hh"
+#include "columnar.hh"
+#include "shmring.hh"
+#include "udpdgram.hh"
 
-// TODO: tune parameters
-static size_t WINDOW_SIZE = 4096;
-static size_t BATCH_SIZE = 2048;
+// A view of a batch of tries. Literal tries pack exactly like
+// `std::tuple<uint64_t, std::string, uint64_t>`, but names are written
+// straight from the input into rpclib's outgoing buffer.
+struct try_batch_ref {
+    const try_ref* first;
+    uint32_t n;
+};
+
+// The name column of a columnar batch: one blob holding every name in
+// order. Like `try_batch_ref`, it packs names straight from the input.
+struct name_column_ref {
+    const try_ref* first;
+    uint32_t n;
+    uint32_t size;          // total length of all names
+};
+
+namespace clmdep_msgpack {
+namespace adaptor {
+template <>
+struct pack<try_batch_ref> {
+    template <typename Stream>
+    packer<Stream>& operator()(packer<Stream>& o, const try_batch_ref& b) const {
+        o.pack_array(b.n);
+        for (const try_ref* t = b.first; t != b.first + b.n; ++t) {
+            o.pack_array(t->kind == try_ref::define ? 4 : 3);
+            o.pack_uint64(t->serial);
+            if (t->kind == try_ref::reference) {
+                o.pack_uint32(t->name_id);
+            } else {
+                o.pack_str(t->name_len);
+                o.pack_str_body(t->name, t->name_len);
+            }
+            o.pack_uint64(t->count);
+            if (t->kind == try_ref::define) {
+                o.pack_uint32(t->name_id);
+            }
+        }
+        return o;
+    }
+};
 
+template <>
+struct pack<name_column_ref> {
+    template <typename Stream>
+    packer<Stream>& operator()(packer<Stream>& o, const name_column_ref& c) const {
+        o.pack_bin(c.size);
+        for (const try_ref* t = c.first; t != c.first + c.n; ++t) {
+            o.pack_bin_body(t->name, t->name_len);
+        }
+        return o;
+    }
+};
+}
+}
+
+
+// The client survives broken connections. If a response is late or a
+// connection drops, `recover` reconnects, resumes the session with its token
+// and first unacknowledged serial, and re-sends every in-flight batch; the
+// server answers tries it already committed from its replay buffer.
 class RPCGameClient {
 public:
-    RPCGameClient(const std::string& host, int port)
-        : _client(host, port) {
-        // Prevent hanging forever on broken connections
-        _client.set_timeout(10000); // ms
+    RPCGameClient(const std::string& host, int port, const client_options& options)
+        : _host(host), _port(port),
+          _nconnections(std::max(options.connections, size_t(1))),
+          _encoding(options.encoding), _flow(options),
+          _latency_csv(options.latency_csv),
+          _window(std::max(_flow.window(), flow_controller::max_window)
+                  + std::max(_flow.batch_size(), flow_controller::max_batch)) {
+        connect();
+        _batch_buf.reserve(std::max(_flow.batch_size(), flow_controller::max_batch));
+        // all connections share one session, and so one serial space and
+        // one dictionary
+        std::tie(_session, _token, _credits) = _clients[0]->call("open_session")
+            .as<std::tuple<uint64_t, uint64_t, uint32_t>>();
+        _min_credits = _credits;
     }
 
     void send_try(const char* name, size_t name_len, uint64_t count) {
         // if window full, process until we have space
-        while (_in_flight_tries >= WINDOW_SIZE) { process_one_batch_response(); }
-
-        _batch_buf.emplace_back(_serial, std::string(name, name_len), count);
+        if (window_full()) {
+            auto stall_start = steady_clock::now();
+            while (window_full()) {
+                if (_in_flight.empty()) {
+                    // only buffered tries exceed the credits
+                    flush_batch();
+                } else {
+                    process_one_batch_response();
+                }
+            }
+            _latency.send_blocked.record(steady_clock::now() - stall_start);
+        }
 
-        // send batch once full
-        if (_batch_buf.size() >= BATCH_SIZE) { flush_batch(); }
+        if (_batch_buf.empty()) {
+            _batch_start = steady_clock::now();
+        }
+        try_ref& t = _batch_buf.emplace_back(_serial, name, uint32_t(name_len),
+                                             try_ref::literal, 0, count);
+        if (_encoding == batch_encoding::dict) { encode_name(t); }
         ++_serial;
+
+        // send batch once full, once the server is idle, or once the
+        // oldest try has waited too long (clock checked every 16 tries)
+        if (_batch_buf.size() >= _flow.batch_size()
+            || _in_flight.empty()
+            || ((_batch_buf.size() & 15) == 0
+                && steady_clock::now() - _batch_start >= _flow.flush_deadline())) {
+            flush_batch();
+        }
     }
 
     void finish() {
@@ -42,148 +134,342 @@ public:
         if (!_batch_buf.empty()) { flush_batch(); }
 
         // drain outstanding batches 
-        while (_in_flight_batches > 0) { process_one_batch_response(); }
+        while (!_in_flight.empty()) { process_one_batch_response(); }
 
-        // Call done() and retrieve checksums from server
-        auto tup = _client.call("done").as<std::tuple<std::string, std::string>>();
-        const std::string& server_client_checksum = std::get<0>(tup);
-        const std::string& server_server_checksum = std::get<1>(tup);
+        // Call done() and retrieve checksums from server. `done` is
+        // idempotent, so if its response is lost, reconnect and ask again.
+        std::tuple<std::string, std::string> tup;
+        while (true) {
+            try {
+                tup = _clients[0]->call("done", _session, _token)
+                    .as<std::tuple<std::string, std::string>>();
+                break;
+            } catch (rpc::rpc_error& e) {
+                fail(e);
+            } catch (std::exception&) {
+                recover(false);
+            }
+        }
+        // let the server stop; if this is lost, it stops after a delay
+        try {
+            _clients[0]->call("goodbye", _session, _token);
+        } catch (std::exception&) {
+        }
 
-        // parse response
-        const std::string& my_client_checksum = client_checksum(),
-            my_server_checksum = server_checksum();
-        bool ok = my_client_checksum == server_client_checksum 
-            && my_server_checksum == server_server_checksum;
-        std::cout << "client checksums: "
-            << my_client_checksum << "/" << server_client_checksum
-            << "\nserver checksums: "
-            << my_server_checksum << "/" << server_server_checksum
-            << "\nmatch: " << (ok ? "true\n" : "false\n");
+        report_checksums(std::get<0>(tup), std::get<1>(tup));
+        _flow.report(std::cerr);
+        std::cerr << std::format("credits: last {}, min {}\n", _credits, _min_credits);
+        _latency.report(std::cerr, _latency_csv);
+        if (_reconnects) {
+            std::cerr << std::format("reconnects: {}\n", _reconnects);
+        }
     }
 
 private:
-    using TryItem = std::tuple<uint64_t, std::string, uint64_t>; // (serial, name, count)
+    struct name_entry {
+        uint32_t id;
+        uint64_t defined_serial;    // serial of the defining try
+    };
 
-    struct Batch {
-        std::vector<uint64_t> serials; // serials of tries in this batch (for response processing)
-        size_t n = 0;                  // number of tries in batch
+    // An in-flight `try_batch` call covering serials
+    // `[first_serial, first_serial + n)`. It keeps its tries until the
+    // response arrives, in case it must be re-sent.
+    struct in_flight_batch {
+        uint64_t first_serial = 0;
+        uint32_t n = 0;
+        steady_clock::time_point opened;    // first try was buffered
+        steady_clock::time_point sent;
+        std::future<clmdep_msgpack::object_handle> response;
+        std::vector<try_ref> tries;
     };
 
-    rpc::client _client;
+    // A response later than this, or a dropped connection, starts recovery
+    static constexpr auto response_timeout = std::chrono::seconds(10);
+    static constexpr auto poll_interval = std::chrono::milliseconds(100);
+    // Reconnection attempts back off exponentially and give up after this
+    static constexpr auto reconnect_timeout = std::chrono::seconds(30);
+
+    // Connections. Batches are spread round-robin; the server puts tries
+    // back in serial order, and `_window` does the same for responses.
+    std::string _host;
+    int _port;
+    size_t _nconnections;
+    std::vector<std::unique_ptr<rpc::client>> _clients;
+    size_t _next_client = 0;
+    batch_encoding _encoding;
+    uint64_t _session = 0;
+    uint64_t _token = 0;
+    size_t _reconnects = 0;
+    // Tries the server lets us have in flight, counting buffered ones
+    // (updated by every response)
+    uint32_t _credits = 0;
+    uint32_t _min_credits = 0;
+    flow_controller _flow;
+    latency_recorder _latency;
+    std::string _latency_csv;
 
     uint64_t _serial = 1;
 
-    std::vector<TryItem> _batch_buf;   // buffer of tries waiting to be sent in a batch
+    std::vector<try_ref> _batch_buf;   // buffer of tries waiting to be sent in a batch
+    steady_clock::time_point _batch_start; // when the first try was buffered
+    std::vector<std::vector<try_ref>> _spare_bufs; // from completed batches
 
-    uint64_t _next_batch_id = 1;   // id of next batch to be sent
-    std::unordered_map<uint64_t, std::future<clmdep_msgpack::object_handle>> _batch_futures;
-    std::unordered_map<uint64_t, Batch> _batches; // batch metadata for in-flight batches
+    // Name dictionary for the `dict` encoding
+    std::unordered_map<std::string_view, name_entry> _names;
 
-    // Delivery ordering
-    std::unordered_map<uint64_t, uint64_t> _pending_responses; // serial -> value
-    uint64_t _next_response_serial = 1;
+    // Reusable column buffers for the `columnar` encoding
+    std::string _counts_column;
+    std::string _name_lens_column;
 
-    // Counts for windowing
-    size_t _in_flight_batches = 0;
+    // In-flight batches, in the order they were sent. This is a delivery-
+    // order queue, not a completion queue: the server runs calls on many
+    // worker threads, so responses can complete in any order, even on one
+    // connection. But tries are delivered in serial order, so the front's
+    // response is the only one that can unblock delivery, and waiting on
+    // it first loses nothing.
+    ring_queue<in_flight_batch> _in_flight;
     size_t _in_flight_tries = 0; // total tries represented by all in-flight batches
 
-    void flush_batch() {
-        if (_batch_buf.empty()) return;
+    // Delivery ordering
+    reorder_window _window;
+
+    // Unacknowledged tries never exceed `replay_capacity`, even with a
+    // larger fixed window, so a reconnect can always resume
+    bool window_full() const {
+        return _in_flight_tries >= _flow.window()
+            || _in_flight_tries + _batch_buf.size() >= _credits
+            || _in_flight_tries + _batch_buf.size() >= replay_capacity
+            || _in_flight.size() >= max_batches_in_flight;
+    }
 
-        // Build meta (serial list) so we can map response vector back to serials
-        Batch meta;
-        meta.n = _batch_buf.size();
-        meta.serials.reserve(meta.n);
-        for (const auto& item : _batch_buf) {
-            meta.serials.push_back(std::get<0>(item));
+    void connect() {
+        _clients.clear();
+        for (size_t i = 0; i != _nconnections; ++i) {
+            auto& c = _clients.emplace_back(std::make_unique<rpc::client>(_host, _port));
+            // Bound synchronous calls; async calls are bounded by
+            // `response_timeout`
+            c->set_timeout(10000); // ms
         }
+        _next_client = 0;
+    }
 
-        const uint64_t batch_id = _next_batch_id++;
-
-        // Fire async batch RPC
-        auto fut = _client.async_call("try_batch", _batch_buf);
+    void flush_batch() {
+        if (_batch_buf.empty()) return;
 
-        _batch_futures.emplace(batch_id, std::move(fut));
-        _batches.emplace(batch_id, std::move(meta));
+        in_flight_batch b;
+        b.first_serial = _batch_buf.front().serial;
+        b.n = _batch_buf.size();
+        b.opened = _batch_start;
+        b.tries.swap(_batch_buf);
+        send_batch(b);
+
+        _in_flight_tries += b.n;
+        _in_flight.push_back(std::move(b));
+
+        if (!_spare_bufs.empty()) {
+            _batch_buf.swap(_spare_bufs.back());
+            _spare_bufs.pop_back();
+        } else {
+            _batch_buf.reserve(std::max(_flow.batch_size(), flow_controller::max_batch));
+        }
+    }
 
-        _in_flight_batches += 1;
-        _in_flight_tries += _batch_buf.size();
+    // Fire async batch RPC. rpclib packs the call before returning.
+    void send_batch(in_flight_batch& b) {
+        try_batch_ref items{b.tries.data(), b.n};
+        b.sent = steady_clock::now();
+        rpc::client& c = *_clients[_next_client];
+        _next_client = (_next_client + 1) % _clients.size();
+        if (_encoding == batch_encoding::dict) {
+            b.response = c.async_call("try_batch_dict", _session, items);
+        } else if (_encoding == batch_encoding::columnar) {
+            b.response = send_columnar(c, items);
+        } else {
+            b.response = c.async_call("try_batch", _session, items);
+        }
+    }
 
-        _batch_buf.clear();
+    // Wait for `b`'s response. Return false if the connection failed.
+    bool receive(in_flight_batch& b, clmdep_msgpack::object_handle& resp) {
+        while (b.response.wait_for(poll_interval) != std::future_status::ready) {
+            if (steady_clock::now() - b.sent >= response_timeout
+                || disconnected()) {
+                return false;
+            }
+        }
+        try {
+            resp = b.response.get();
+            return true;
+        } catch (rpc::rpc_error& e) {
+            fail(e);
+        } catch (std::exception&) {
+            return false;
+        }
     }
 
-    void process_one_batch_response() {
-        if (_batch_futures.empty()) { return; }
-
-        // Prefer to wait on a batch that might enable in-order delivery.
-        // (Heuristic: batch containing _next_response_serial)
-        uint64_t chosen_id = 0;
-        for (const auto& [bid, meta] : _batches) {
-            // meta.serials is sorted increasing because serials increase monotonically
-            if (!meta.serials.empty() &&
-                meta.serials.front() <= _next_response_serial &&
-                _next_response_serial <= meta.serials.back()) {
-                chosen_id = bid;
-                break;
+    bool disconnected() const {
+        using state = rpc::client::connection_state;
+        for (auto& c : _clients) {
+            state st = c->get_connection_state();
+            if (st == state::disconnected || st == state::reset) {
+                return true;
             }
         }
+        return false;
+    }
 
-        // Otherwise: pick any ready batch
-        if (chosen_id == 0) {
-            for (const auto& [bid, fut] : _batch_futures) {
-                if (fut.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
-                    chosen_id = bid;
-                    break;
+    // Reconnect, resume the session unless `resume` is false, and re-send
+    // every in-flight batch
+    void recover(bool resume = true) {
+        auto deadline = steady_clock::now() + reconnect_timeout;
+        auto backoff = std::chrono::milliseconds(10);
+        uint64_t serial = _window.next_serial();
+        while (true) {
+            try {
+                connect();
+                bool ok = !resume
+                    || _clients[0]->call("resume_session", _session, _token, serial)
+                           .as<bool>();
+                if (!ok) {
+                    std::cerr << "client: server cannot resume session at serial "
+                              << serial << "\n";
+                    std::exit(1);
+                }
+                break;
+            } catch (rpc::rpc_error& e) {
+                fail(e);
+            } catch (std::exception& e) {
+                if (steady_clock::now() + backoff >= deadline) {
+                    std::cerr << "client: cannot reconnect: " << e.what() << "\n";
+                    std::exit(1);
                 }
+                std::this_thread::sleep_for(backoff);
+                backoff = std::min(backoff * 2, std::chrono::milliseconds(1000));
             }
         }
-
-        // Otherwise: block on some batch
-        if (chosen_id == 0) {
-            chosen_id = _batch_futures.begin()->first;
+        ++_reconnects;
+        for (size_t i = 0; i != _in_flight.size(); ++i) {
+            send_batch(_in_flight[i]);
         }
+    }
 
-        auto fit = _batch_futures.find(chosen_id);
-        auto mit = _batches.find(chosen_id);
+    // The server rejected a call
+    [[noreturn]] void fail(rpc::rpc_error& e) {
+        std::cerr << "client: " << e.what() << "\n";
+        std::exit(1);
+    }
 
-        // Get returned vector<uint64_t>
-        clmdep_msgpack::object_handle resp = fit->second.get();
-        std::vector<uint64_t> values = resp.as<std::vector<uint64_t>>();
+    // Columnar batch: (session, serial_base, n, counts, name_lens, names).
+    // Counts and name lengths are varint columns; names are concatenated.
+    // The response is `n` little-endian uint64_t values in one binary blob.
+    std::future<clmdep_msgpack::object_handle> send_columnar(rpc::client& c,
+                                                             try_batch_ref items) {
+        _counts_column.clear();
+        _name_lens_column.clear();
+        uint32_t names_size = append_columns(_counts_column, _name_lens_column,
+                                             items.first, items.first + items.n);
+        using clmdep_msgpack::type::raw_ref;
+        return c.async_call("try_batch_columnar",
+            _session, items.first->serial, items.n,
+            raw_ref(_counts_column.data(), _counts_column.size()),
+            raw_ref(_name_lens_column.data(), _name_lens_column.size()),
+            name_column_ref{items.first, items.n, names_size});
+    }
 
-        Batch& meta = mit->second;
-        if (values.size() != meta.n) {
-            std::cerr << "try_batch returned wrong size: expected " << meta.n
-                      << " got " << values.size() << "\n";
-            std::exit(1);
+    void encode_name(try_ref& t) {
+        std::string_view name(t.name, t.name_len);
+        auto it = _names.find(name);
+        if (it == _names.end()) {
+            if (_names.size() < name_dictionary_capacity) {
+                uint32_t id = _names.size();
+                _names.emplace(name, name_entry{id, t.serial});
+                t.kind = try_ref::define;
+                t.name_id = id;
+            }
+        } else if (it->second.defined_serial < _window.next_serial()) {
+            // The server has processed the definition, so any batch sent
+            // from now on can use the ID. Until then, keep sending the name.
+            t.kind = try_ref::reference;
+            t.name_id = it->second.id;
         }
+    }
 
-        // Insert responses into pending map keyed by serial.
-        for (size_t i = 0; i < meta.n; ++i) {
-            _pending_responses.emplace(meta.serials[i], values[i]);
+    void process_one_batch_response() {
+        in_flight_batch& b = _in_flight.front();
+        clmdep_msgpack::object_handle resp;
+        while (!receive(b, resp)) {
+            recover();
         }
-
-        // Remove this batch from tracking
-        _in_flight_batches -= 1;
-        _in_flight_tries -= meta.n;
-
-        _batch_futures.erase(fit);
-        _batches.erase(mit);
-
-        // Deliver in serial order
-        while (true) {
-            auto it = _pending_responses.find(_next_response_serial);
-            if (it == _pending_responses.end()) break;
-            client_recv_try_response(it->second);
-            _pending_responses.erase(it);
-            ++_next_response_serial;
+        auto arrived = steady_clock::now();
+        const clmdep_msgpack::object& r = resp.get();
+
+        // Response is (credits, values). Values are a vector<uint64_t>, or
+        // for `columnar`, a blob of little-endian uint64_ts
+        bool ok = r.type == clmdep_msgpack::type::ARRAY
+            && r.via.array.size == 2
+            && r.via.array.ptr[0].type == clmdep_msgpack::type::POSITIVE_INTEGER;
+        const clmdep_msgpack::object& obj = ok ? r.via.array.ptr[1] : r;
+        if (ok && _encoding == batch_encoding::columnar) {
+            ok = obj.type == clmdep_msgpack::type::BIN
+                && obj.via.bin.size == b.n * sizeof(uint64_t);
+            for (uint32_t i = 0; ok && i != b.n; ++i) {
+                _window.put(b.first_serial + i,
+                            load_le64(obj.via.bin.ptr + i * sizeof(uint64_t)),
+                            arrived);
+            }
+        } else if (ok) {
+            ok = obj.type == clmdep_msgpack::type::ARRAY
+                && obj.via.array.size == b.n;
+            for (uint32_t i = 0; ok && i != b.n; ++i) {
+                const clmdep_msgpack::object& v = obj.via.array.ptr[i];
+                ok = v.type == clmdep_msgpack::type::POSITIVE_INTEGER;
+                if (ok) {
+                    _window.put(b.first_serial + i, v.via.u64, arrived);
+                }
+            }
+        }
+        if (!ok) {
+            std::cerr << "try_batch returned bad response for serials "
+                      << b.first_serial << "-" << b.first_serial + b.n - 1 << "\n";
+            std::exit(1);
         }
+        _credits = std::max(uint32_t(r.via.array.ptr[0].via.u64), uint32_t(1));
+        _min_credits = std::min(_min_credits, _credits);
+
+        auto rtt = steady_clock::now() - b.sent;
+        _flow.on_response(b.first_serial, b.n, rtt, _serial);
+        _latency.batch_rtt.record(rtt);
+        auto opened = b.opened;
+        uint32_t n = b.n;
+        _in_flight_tries -= b.n;
+        b.tries.clear();
+        _spare_bufs.push_back(std::move(b.tries));
+        _in_flight.pop_front();
+
+        _window.deliver(_latency.reorder_wait);
+        _latency.try_latency.record(steady_clock::now() - opened, n);
     }
 };
 
 static std::unique_ptr<RPCGameClient> client;
+static bool shm_transport = false;
+static bool udp_transport = false;
+
+void client_connect(std::string address, const client_options& options) {
+    // "shm:/name" selects the shared-memory transport, which ignores `options`
+    if (is_shm_address(address)) {
+        shm_transport = true;
+        shm_client_connect(std::move(address));
+        return;
+    }
+    // "udp:host:port" selects the datagram transport
+    if (is_udp_address(address)) {
+        udp_transport = true;
+        udp_client_connect(std::move(address), options);
+        return;
+    }
 
-void client_connect(std::string address) {
-    // address format is "host:port"
+    // otherwise the address format is "host:port"
     size_t colon = address.find(':');
     if (colon == std::string::npos) {
         std::cerr << "client_connect: bad address (expected host:port): " << address << "\n";
@@ -193,13 +479,28 @@ void client_connect(std::string address) {
     std::string host = address.substr(0, colon);
     int port = std::stoi(address.substr(colon + 1));
 
-    client = std::make_unique<RPCGameClient>(host, port);
+    client = std::make_unique<RPCGameClient>(host, port, options);
 }
 
 void client_send_try(const char* name, size_t name_len, uint64_t count) {
-    client->send_try(name, name_len, count);
+    if (shm_transport) {
+        shm_client_send_try(name, name_len, count);
+    } else if (udp_transport) {
+        udp_client_send_try(name, name_len, count);
+    } else {
+        client->send_try(name, name_len, count);
+    }
 }
 
 void client_finish() {
-    client->finish();
+    if (shm_transport) {
+        shm_client_finish();
+    } else if (udp_transport) {
+        udp_client_finish();
+    } else {
+        client->finish();
+        // destroying the rpc clients joins their I/O threads, whose counts
+        // then reach the caller's `perf_counters`
+        client.reset();
+    }
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+#ifndef CS2620_PSET1_COLUMNAR_HH
+#define CS2620_PSET1_COLUMNAR_HH
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "batching.hh"
+
+// Columnar try batches, used by the rpclib `try_batch_columnar` RPC and by
+// the cotamer transport.
+//
+// A batch covers serials `[serial_base, serial_base + n)`. The `counts` and
+// `name_lens` columns hold one LEB128 varint per try, and `names` holds all
+// names concatenated. The response is `n` little-endian uint64_t values.
+
+// - append the count and name-length columns for tries `[first, last)`;
+//   return the total length of their names
+inline size_t append_columns(std::string& counts, std::string& name_lens,
+                             const try_ref* first, const try_ref* last) {
+    size_t names_size = 0;
+    for (; first != last; ++first) {
+        put_varint(counts, first->count);
+        put_varint(name_lens, first->name_len);
+        names_size += first->name_len;
+    }
+    return names_size;
+}
+
+// - throw `std::invalid_argument` if columns of these sizes cannot hold
+//   `n` tries. Every varint takes at least one byte, so callers can check
+//   this before sizing a response for `n` values.
+inline void check_columnar_size(uint32_t n, size_t counts_size,
+                                size_t name_lens_size) {
+    if (n > counts_size || n > name_lens_size) {
+        throw std::invalid_argument("malformed columnar batch");
+    }
+}
+
+// - process the tries of a columnar batch in session `session` with
+//   `server_process_batch`, storing their values to `out` (which has room
+//   for `n` values); throw `std::invalid_argument` if the batch is
+//   malformed, including if any column has bytes left over. Names are
+//   hashed while parsing, before the batch waits for its turn.
+inline void process_columnar_batch(uint64_t session,
+                                   uint64_t serial_base, uint32_t n,
+                                   std::string_view counts,
+                                   std::string_view name_lens,
+                                   std::string_view names,
+                                   char* out) {
+    check_columnar_size(n, counts.size(), name_lens.size());
+    thread_local std::vector<prepared_try> tries;
+    thread_local std::vector<uint64_t> values;
+    tries.clear();
+    values.resize(n);
+
+    const char* cp = counts.data();
+    const char* cend = cp + counts.size();
+    const char* lp = name_lens.data();
+    const char* lend = lp + name_lens.size();
+    const char* np = names.data();
+    const char* nend = np + names.size();
+    for (uint32_t i = 0; i != n; ++i) {
+        uint64_t count, name_len;
+        if (!get_varint(cp, cend, count)
+            || !get_varint(lp, lend, name_len)
+            || name_len > size_t(nend - np)) {
+            throw std::invalid_argument("malformed columnar batch");
+        }
+        tries.push_back(prepare_try(np, name_len, count));
+        np += name_len;
+    }
+    if (cp != cend || lp != lend || np != nend) {
+        throw std::invalid_argument("malformed columnar batch");
+    }
+
+    server_process_batch(session, serial_base, tries.data(), n, values.data());
+    for (uint32_t i = 0; i != n; ++i) {
+        store_le64(out + i * sizeof(uint64_t), values[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,203 @@
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "columnar.hh"
+#include "ctframe.hh"
+
+// rpcgame client on the cotamer event loop.
+//
+// The client API is synchronous, so the stub runs the driver only while
+// it must wait: `run_until` starts a `pump` coroutine that writes pending
+// frames and reads responses until a condition holds, and then runs
+// `cotamer::loop()` until the pump returns.
+
+namespace cot = cotamer;
+
+namespace {
+
+class ct_client : public batch_stream {
+public:
+    ct_client(std::string address, const client_options& options);
+
+    void send_try(const char* name, size_t name_len, uint64_t count);
+    void finish();
+
+private:
+    cot::fd _fd;
+    std::string _counts_column;
+    std::string _name_lens_column;
+    ct_inbuf _in;
+    reorder_window _window;
+
+    bool _done_received = false;
+    std::string _server_checksums[2];
+
+    void flush_batch();
+    bool read_some();
+    void process_frame(ct_frame_type type, std::string_view payload);
+
+    bool done_received() const {
+        return _done_received;
+    }
+    void run_until(bool (ct_client::*pred)() const);
+    cot::task<> pump(bool (ct_client::*pred)() const);
+};
+
+ct_client::ct_client(std::string address, const client_options& options)
+    : batch_stream(options),
+      _window(std::max(_flow.window(), flow_controller::max_window)
+              + std::max(_flow.batch_size(), flow_controller::max_batch)) {
+    cot::set_clock(cot::clock::real_time);
+    auto connect = [] (std::string address, cot::fd& f) -> cot::task<> {
+        f = co_await cot::tcp_connect(std::move(address));
+    };
+    auto t = connect(std::move(address), _fd);
+    cot::loop();
+    if (!_fd) {
+        std::cerr << "client_connect: connection failed\n";
+        std::exit(1);
+    }
+}
+
+void ct_client::send_try(const char* name, size_t name_len, uint64_t count) {
+    if (!window_open()) {
+        auto stall_start = steady_clock::now();
+        run_until(&ct_client::window_open);
+        _latency.send_blocked.record(steady_clock::now() - stall_start);
+    }
+    if (add_try(name, name_len, count)) {
+        flush_batch();
+    }
+}
+
+void ct_client::flush_batch() {
+    if (_batch_buf.empty()) {
+        return;
+    }
+    const try_ref* first = _batch_buf.data();
+    const try_ref* last = first + _batch_buf.size();
+    _counts_column.clear();
+    _name_lens_column.clear();
+    append_columns(_counts_column, _name_lens_column, first, last);
+
+    size_t pos = ct_begin_frame(_out, ct_try_batch);
+    ct_put64(_out, first->serial);
+    ct_put32(_out, _batch_buf.size());
+    ct_put32(_out, _counts_column.size());
+    ct_put32(_out, _name_lens_column.size());
+    _out.append(_counts_column);
+    _out.append(_name_lens_column);
+    for (const try_ref* t = first; t != last; ++t) {
+        _out.append(t->name, t->name_len);
+    }
+    ct_end_frame(_out, pos);
+    batch_sent();
+
+    // send now if the socket has room; `pump` sends the rest
+    write_some(_fd.fileno());
+}
+
+// Read and process available input without blocking. Returns true if
+// anything was read.
+bool ct_client::read_some() {
+    ssize_t nr = _in.fill(_fd.fileno());
+    if (nr == 0) {
+        throw std::runtime_error("server closed connection");
+    }
+    ct_frame_type type;
+    std::string_view payload;
+    while (_in.next(type, payload)) {
+        process_frame(type, payload);
+    }
+    return nr > 0;
+}
+
+void ct_client::process_frame(ct_frame_type type, std::string_view payload) {
+    if (type == ct_try_response && payload.size() >= ct_try_response_header_size) {
+        auto arrived = steady_clock::now();
+        uint64_t serial_base = load_le64(payload.data());
+        uint32_t n = load_le32(payload.data() + 8);
+        payload.remove_prefix(ct_try_response_header_size);
+        expect_response(serial_base, n);
+        if (payload.size() != size_t(n) * sizeof(uint64_t)) {
+            throw std::runtime_error("unexpected try response");
+        }
+        for (uint32_t i = 0; i != n; ++i) {
+            _window.put(serial_base + i, load_le64(payload.data() + i * sizeof(uint64_t)),
+                        arrived);
+        }
+        _window.deliver(_latency.reorder_wait);
+        batch_answered(arrived);
+    } else if (type == ct_done_response) {
+        for (std::string& ck : _server_checksums) {
+            if (payload.size() < 4 || payload.size() - 4 < load_le32(payload.data())) {
+                throw std::runtime_error("bad done response");
+            }
+            ck.assign(payload.substr(4, load_le32(payload.data())));
+            payload.remove_prefix(4 + ck.size());
+        }
+        _done_received = true;
+    } else {
+        throw std::runtime_error("unexpected frame");
+    }
+}
+
+cot::task<> ct_client::pump(bool (ct_client::*pred)() const) {
+    try {
+        while (!(this->*pred)()) {
+            bool progress = write_some(_fd.fileno());
+            progress = read_some() || progress;
+            if (!progress && !(this->*pred)()) {
+                if (output_pending()) {
+                    co_await cot::any(cot::readable(_fd), cot::writable(_fd));
+                } else {
+                    co_await cot::readable(_fd);
+                }
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << "client: " << e.what() << "\n";
+        std::exit(1);
+    }
+}
+
+void ct_client::run_until(bool (ct_client::*pred)() const) {
+    auto t = pump(pred);
+    cot::loop();
+    assert(t.done());
+}
+
+void ct_client::finish() {
+    flush_batch();
+    run_until(&ct_client::drained);
+
+    size_t pos = ct_begin_frame(_out, ct_done);
+    ct_end_frame(_out, pos);
+    run_until(&ct_client::done_received);
+
+    report(_server_checksums[0], _server_checksums[1]);
+}
+
+std::unique_ptr<ct_client> client;
+
+}
+
+
+void client_connect(std::string address, const client_options& options) {
+    // address format is "host:port"; only the columnar encoding is
+    // supported, and batches always use one connection
+    client = std::make_unique<ct_client>(std::move(address), options);
+}
+
+void client_send_try(const char* name, size_t name_len, uint64_t count) {
+    client->send_try(name, name_len, count);
+}
+
+void client_finish() {
+    client->finish();
+}
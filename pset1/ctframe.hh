@@ -0,0 +1,97 @@
+#ifndef CS2620_PSET1_CTFRAME_HH
+#define CS2620_PSET1_CTFRAME_HH
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "cotamer/cotamer.hh"
+#include "rpcgame.hh"
+#include "stream.hh"
+
+// Framing for the cotamer transport.
+//
+// A frame is a little-endian uint32_t payload length, a one-byte frame
+// type, and the payload. Integers in payloads are little-endian.
+
+enum ct_frame_type : uint8_t {
+    ct_try_batch = 1,       // u64 serial_base, u32 n, u32 counts size,
+                            // u32 name_lens size, then the three columns
+                            // of a columnar batch (see `columnar.hh`)
+    ct_try_response = 2,    // u64 serial_base, u32 n, n u64 values
+    ct_done = 3,            // empty
+    ct_done_response = 4    // u32 size, client checksum,
+                            // u32 size, server checksum
+};
+
+constexpr size_t ct_frame_header_size = 5;
+constexpr size_t ct_try_batch_header_size = 20;
+constexpr size_t ct_try_response_header_size = 12;
+constexpr size_t ct_max_frame_size = 64 << 20;
+
+
+// - start a frame of type `type` at the end of `buf`; return its position
+inline size_t ct_begin_frame(std::string& buf, ct_frame_type type) {
+    size_t pos = buf.size();
+    buf.resize(pos + ct_frame_header_size);
+    buf[pos + 4] = char(type);
+    return pos;
+}
+
+// - finish the frame that starts at `pos`
+inline void ct_end_frame(std::string& buf, size_t pos) {
+    store_le32(buf.data() + pos, buf.size() - pos - ct_frame_header_size);
+}
+
+// - append little-endian integers
+inline void ct_put32(std::string& buf, uint32_t value) {
+    buf.resize(buf.size() + sizeof(value));
+    store_le32(buf.data() + buf.size() - sizeof(value), value);
+}
+
+inline void ct_put64(std::string& buf, uint64_t value) {
+    buf.resize(buf.size() + sizeof(value));
+    store_le64(buf.data() + buf.size() - sizeof(value), value);
+}
+
+
+// ct_inbuf
+//    Input buffer for a framed connection.
+
+class ct_inbuf : public stream_inbuf {
+public:
+    using stream_inbuf::fill;
+
+    // Read whatever is available from `f` into the buffer, suspending if
+    // nothing is. Returns false at EOF.
+    inline cotamer::task<bool> fill(const cotamer::fd& f);
+
+    // Extract the next complete frame. `payload` remains valid until the
+    // next `fill`.
+    inline bool next(ct_frame_type& type, std::string_view& payload);
+};
+
+inline cotamer::task<bool> ct_inbuf::fill(const cotamer::fd& f) {
+    make_room();
+    size_t nr = co_await cotamer::read_once(f, _buf.data() + _tail, _buf.size() - _tail);
+    _tail += nr;
+    co_return nr != 0;
+}
+
+inline bool ct_inbuf::next(ct_frame_type& type, std::string_view& payload) {
+    if (_tail - _head < ct_frame_header_size) {
+        return false;
+    }
+    uint32_t size = load_le32(_buf.data() + _head);
+    if (size > ct_max_frame_size) {
+        throw std::runtime_error("frame too large");
+    } else if (_tail - _head < ct_frame_header_size + size) {
+        return false;
+    }
+    type = ct_frame_type(_buf[_head + 4]);
+    payload = std::string_view(_buf.data() + _head + ct_frame_header_size, size);
+    _head += ct_frame_header_size + size;
+    return true;
+}
+
+#endif
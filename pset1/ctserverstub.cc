@@ -0,0 +1,146 @@
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "columnar.hh"
+#include "ctframe.hh"
+#include "shmring.hh"
+#include "udpdgram.hh"
+
+// Single-threaded rpcgame server on the cotamer event loop. Every
+// connection is served by its own coroutine and is its own session. A
+// connection delivers its batches in order, so the server runs in
+// `rpc_server`'s single-threaded mode: batches commit directly, with no
+// session lock or sequencer.
+
+namespace cot = cotamer;
+
+namespace {
+
+cot::fd listener;
+
+
+cot::task<> write_all(const cot::fd& f, std::string& out) {
+    if (!out.empty()) {
+        co_await cot::write(f, out.data(), out.size());
+        out.clear();
+    }
+}
+
+// Process a `ct_try_batch` payload for `session`, whose next serial is
+// `next_serial`, appending the response frame to `out`
+void serve_try_batch(uint64_t session, uint64_t& next_serial,
+                     std::string_view payload, std::string& out) {
+    if (payload.size() < ct_try_batch_header_size) {
+        throw std::runtime_error("short try batch");
+    }
+    uint64_t serial_base = load_le64(payload.data());
+    uint32_t n = load_le32(payload.data() + 8);
+    uint32_t counts_size = load_le32(payload.data() + 12);
+    uint32_t name_lens_size = load_le32(payload.data() + 16);
+    payload.remove_prefix(ct_try_batch_header_size);
+    if (uint64_t(counts_size) + name_lens_size > payload.size()) {
+        throw std::runtime_error("bad try batch");
+    }
+    check_columnar_size(n, counts_size, name_lens_size);
+
+    if (serial_base != next_serial) {
+        throw std::runtime_error("out-of-order try batch");
+    }
+
+    size_t pos = ct_begin_frame(out, ct_try_response);
+    ct_put64(out, serial_base);
+    ct_put32(out, n);
+    size_t values = out.size();
+    out.resize(values + size_t(n) * sizeof(uint64_t));
+    process_columnar_batch(session, serial_base, n,
+                           payload.substr(0, counts_size),
+                           payload.substr(counts_size, name_lens_size),
+                           payload.substr(counts_size + name_lens_size),
+                           out.data() + values);
+    ct_end_frame(out, pos);
+    next_serial += n;
+}
+
+cot::task<> serve_connection(cot::fd f) {
+    ct_inbuf in;
+    std::string out;
+    uint64_t session = 0;           // opened by the first frame
+    uint64_t next_serial = 1;
+    bool closed = false;
+    try {
+        while (co_await in.fill(f)) {
+            ct_frame_type type;
+            std::string_view payload;
+            bool done = false;
+            while (in.next(type, payload)) {
+                if (session == 0) {
+                    session = server_open_session();
+                }
+                if (type == ct_try_batch) {
+                    serve_try_batch(session, next_serial, payload, out);
+                } else if (type == ct_done && !closed) {
+                    session_summary sum = server_close_session(session);
+                    closed = true;
+                    size_t pos = ct_begin_frame(out, ct_done_response);
+                    for (const std::string* ck : {&sum.client_checksum,
+                                                  &sum.server_checksum}) {
+                        ct_put32(out, ck->size());
+                        out.append(*ck);
+                    }
+                    ct_end_frame(out, pos);
+                    done = sum.last;
+                } else {
+                    throw std::runtime_error("unexpected frame");
+                }
+            }
+            co_await write_all(f, out);
+            if (done) {
+                // stop accepting; the loop exits once clients disconnect
+                listener.close();
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << "connection: " << e.what() << "\n";
+    }
+    // a client that disconnects without `ct_done` still finishes its
+    // session, so the server can exit once every expected session ends
+    if (session != 0 && !closed && server_close_session(session).last) {
+        listener.close();
+    }
+}
+
+cot::task<> accept_loop(std::string address) {
+    listener = co_await cot::tcp_listen(address);
+    std::cout << "Server listening on " << address << "\n" << std::flush;
+    while (listener) {
+        try {
+            cot::fd f = co_await cot::tcp_accept(listener);
+            serve_connection(std::move(f)).detach();
+        } catch (std::exception&) {
+            // `listener` was closed
+        }
+    }
+}
+
+}
+
+
+void server_start(std::string address, size_t nthreads) {
+    if (is_shm_address(address) || is_udp_address(address)) {
+        std::cerr << "-s, -u: the cotamer server supports only TCP\n";
+        std::exit(1);
+    } else if (nthreads > 1) {
+        std::cerr << "-j: the cotamer server is single-threaded\n";
+        std::exit(1);
+    }
+    server_set_single_threaded();
+    cot::set_clock(cot::clock::real_time);
+    accept_loop(std::move(address)).detach();
+    cot::loop();
+    std::cout << "Server exiting\n";
+}
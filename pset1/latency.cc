@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include "latency.hh"
+
+uint64_t latency_histogram::bucket_upper(unsigned b) {
+    if (b < (1U << sub_bits)) {
+        return b;
+    }
+    unsigned e = (b >> sub_bits) + sub_bits - 1;
+    uint64_t mantissa = b & ((1U << sub_bits) - 1);
+    uint64_t lower = ((uint64_t(1) << sub_bits) + mantissa) << (e - sub_bits);
+    return lower + (uint64_t(1) << (e - sub_bits)) - 1;
+}
+
+uint64_t latency_histogram::percentile_ns(double p) const {
+    if (_count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max(uint64_t(std::ceil(p / 100 * _count)), uint64_t(1));
+    uint64_t seen = 0;
+    for (unsigned b = 0; b != nbuckets; ++b) {
+        seen += _counts[b];
+        if (seen >= rank) {
+            return std::min(bucket_upper(b), _max);
+        }
+    }
+    return _max;
+}
+
+void latency_histogram::report(std::ostream& out, const char* name) const {
+    out << std::format("{}: {} samples, p50 {:.1f} us, p99 {:.1f} us, "
+                       "p99.9 {:.1f} us, max {:.1f} us\n",
+                       name, _count,
+                       percentile_ns(50) / 1e3, percentile_ns(99) / 1e3,
+                       percentile_ns(99.9) / 1e3, _max / 1e3);
+}
+
+void latency_histogram::write_csv(std::ostream& out, const char* name) const {
+    uint64_t seen = 0;
+    for (unsigned b = 0; b != nbuckets; ++b) {
+        if (_counts[b] != 0) {
+            seen += _counts[b];
+            out << std::format("{},{},{},{:.6f}\n", name,
+                               std::min(bucket_upper(b), _max), _counts[b],
+                               double(seen) / _count);
+        }
+    }
+}
+
+
+void latency_recorder::report(std::ostream& out,
+                              const std::string& csv_filename) const {
+    batch_rtt.report(out, "latency: batch rtt");
+    try_latency.report(out, "latency: try");
+    reorder_wait.report(out, "latency: reorder wait");
+    send_blocked.report(out, "latency: send blocked");
+
+    if (!csv_filename.empty()) {
+        std::ofstream csv(csv_filename);
+        csv << "histogram,upper_ns,count,cumulative_fraction\n";
+        batch_rtt.write_csv(csv, "batch_rtt");
+        try_latency.write_csv(csv, "try_latency");
+        reorder_wait.write_csv(csv, "reorder_wait");
+        send_blocked.write_csv(csv, "send_blocked");
+        if (!csv) {
+            out << csv_filename << ": " << strerror(errno) << "\n";
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef CS2620_PSET1_LATENCY_HH
+#define CS2620_PSET1_LATENCY_HH
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// latency_histogram
+//    HDR-style histogram of durations in nanoseconds. Values below
+//    2^`sub_bits` ns get their own buckets; above that, each power of two
+//    is split into 2^`sub_bits` buckets, so a bucket's width is at most
+//    about 3% of its values. Recording is a few instructions.
+
+class latency_histogram {
+public:
+    using duration = std::chrono::steady_clock::duration;
+
+    // - record `n` samples of `d`
+    inline void record(duration d, uint64_t n = 1);
+
+    uint64_t count() const {
+        return _count;
+    }
+    uint64_t max_ns() const {
+        return _max;
+    }
+    // - return the smallest recorded value (rounded up to its bucket's
+    //   upper bound) that is at least `p` percent of samples
+    uint64_t percentile_ns(double p) const;
+
+    // - print count, p50, p99, p99.9, and max on one line
+    void report(std::ostream& out, const char* name) const;
+    // - write one CSV row per nonempty bucket
+    void write_csv(std::ostream& out, const char* name) const;
+
+private:
+    static constexpr unsigned sub_bits = 5;
+    static constexpr unsigned nbuckets = (64 - sub_bits + 1) << sub_bits;
+
+    std::array<uint64_t, nbuckets> _counts = {};
+    uint64_t _count = 0;
+    uint64_t _max = 0;
+
+    static inline unsigned bucket(uint64_t ns);
+    static uint64_t bucket_upper(unsigned b);
+};
+
+inline unsigned latency_histogram::bucket(uint64_t ns) {
+    if (ns < (uint64_t(1) << sub_bits)) {
+        return ns;
+    }
+    unsigned e = std::bit_width(ns) - 1;
+    unsigned mantissa = (ns >> (e - sub_bits)) & ((1U << sub_bits) - 1);
+    return ((e - sub_bits + 1) << sub_bits) + mantissa;
+}
+
+inline void latency_histogram::record(duration d, uint64_t n) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    uint64_t v = ns > 0 ? ns : 0;
+    _counts[bucket(v)] += n;
+    _count += n;
+    _max = v > _max ? v : _max;
+}
+
+
+// latency_recorder
+//    Latencies measured by the client stubs.
+//    - `batch_rtt`: from a batch's send to its response.
+//    - `try_latency`: from the moment a try's batch opened (its first try
+//      was buffered) to the delivery of the batch's tries to
+//      `client_recv_try_response`. It is recorded once per batch with
+//      weight `n`, so it mixes batching delay, RTT, and reordering, and
+//      overstates the wait of a batch's later tries.
+//    - `reorder_wait`: per try, from the arrival of its response to its
+//      in-order delivery, i.e., the time spent waiting for earlier tries.
+//      It stays near zero where responses arrive in order; the protobuf
+//      client, which needs no reordering, records none.
+//    - `send_blocked`: each period `client_send_try` spent blocked because
+//      the send window was full.
+
+struct latency_recorder {
+    latency_histogram batch_rtt;
+    latency_histogram try_latency;
+    latency_histogram reorder_wait;
+    latency_histogram send_blocked;
+
+    // - print every histogram; if `csv_filename` is nonempty, also write
+    //   them there as CSV
+    void report(std::ostream& out, const std::string& csv_filename = {}) const;
+};
+
+#endif
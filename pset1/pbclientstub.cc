@@ -0,0 +1,184 @@
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <poll.h>
+
+#include "batching.hh"
+#include "pbframe.hh"
+
+// rpcgame client speaking the `RPCGame.Stream` protobuf service over plain
+// TCP.
+//
+// Batching and flow control are shared with the cotamer client (see
+// `batch_stream`). Each batch is one `StreamRequest` built in an arena
+// and serialized straight into the output buffer, followed by its names
+// (see `pbframe.hh`). The socket is nonblocking, and the client polls it
+// only while it must wait.
+
+namespace {
+
+class pb_client : public batch_stream {
+public:
+    pb_client(const std::string& address, const client_options& options);
+    ~pb_client();
+
+    void send_try(const char* name, size_t name_len, uint64_t count);
+    void finish();
+
+private:
+    int _fd;
+    pb_arena _arena;
+    pb_inbuf _in;
+
+    bool _done_received = false;
+    std::string _server_checksums[2];
+
+    void flush_batch();
+    bool read_some();
+    void process_frame(std::string_view payload);
+    void pump();
+};
+
+pb_client::pb_client(const std::string& address, const client_options& options)
+    : batch_stream(options), _fd(stream_connect(address)) {
+}
+
+pb_client::~pb_client() {
+    close(_fd);
+}
+
+void pb_client::send_try(const char* name, size_t name_len, uint64_t count) {
+    if (!window_open()) {
+        auto stall_start = steady_clock::now();
+        while (!window_open()) {
+            pump();
+        }
+        _latency.send_blocked.record(steady_clock::now() - stall_start);
+    }
+    if (add_try(name, name_len, count)) {
+        flush_batch();
+    }
+}
+
+void pb_client::flush_batch() {
+    if (_batch_buf.empty()) {
+        return;
+    }
+    const try_ref* first = _batch_buf.data();
+    const try_ref* last = first + _batch_buf.size();
+    auto* req = google::protobuf::Arena::CreateMessage<rpcgame::StreamRequest>(_arena.get());
+    auto* batch = req->mutable_batch();
+    batch->set_serial_base(first->serial);
+    batch->mutable_counts()->Reserve(_batch_buf.size());
+    batch->mutable_name_lens()->Reserve(_batch_buf.size());
+    size_t names_size = 0;
+    for (const try_ref* t = first; t != last; ++t) {
+        batch->add_counts(t->count);
+        batch->add_name_lens(t->name_len);
+        names_size += t->name_len;
+    }
+    pb_append_frame(_out, *req, names_size);
+    for (const try_ref* t = first; t != last; ++t) {
+        _out.append(t->name, t->name_len);
+    }
+    _arena.reset();
+    batch_sent();
+
+    // send now if the socket has room; `pump` sends the rest
+    write_some(_fd);
+}
+
+// Read and process available input without blocking. Returns true if
+// anything was read.
+bool pb_client::read_some() {
+    ssize_t nr = _in.fill(_fd);
+    if (nr == 0) {
+        throw std::runtime_error("server closed connection");
+    }
+    std::string_view payload, trailer;
+    while (_in.next(payload, trailer)) {
+        process_frame(payload);
+    }
+    return nr > 0;
+}
+
+void pb_client::process_frame(std::string_view payload) {
+    auto* resp = google::protobuf::Arena::CreateMessage<rpcgame::StreamResponse>(_arena.get());
+    if (!resp->ParseFromArray(payload.data(), payload.size())) {
+        throw std::runtime_error("bad frame");
+    }
+    if (resp->has_batch()) {
+        auto arrived = steady_clock::now();
+        const auto& batch = resp->batch();
+        expect_response(batch.serial_base(), batch.values_size());
+        // responses arrive in serial order
+        for (uint64_t value : batch.values()) {
+            client_recv_try_response(value);
+        }
+        batch_answered(arrived);
+    } else if (resp->has_done()) {
+        _server_checksums[0] = resp->done().client_checksum();
+        _server_checksums[1] = resp->done().server_checksum();
+        _done_received = true;
+    } else {
+        throw std::runtime_error("unexpected frame");
+    }
+    _arena.reset();
+}
+
+// Write and read what the socket allows, waiting if neither makes progress
+void pb_client::pump() {
+    try {
+        bool progress = write_some(_fd);
+        progress = read_some() || progress;
+        if (!progress) {
+            pollfd p = {_fd, short(POLLIN | (output_pending() ? POLLOUT : 0)), 0};
+            poll(&p, 1, -1);
+        }
+    } catch (std::exception& e) {
+        std::cerr << "client: " << e.what() << "\n";
+        std::exit(1);
+    }
+}
+
+void pb_client::finish() {
+    flush_batch();
+    while (!drained()) {
+        pump();
+    }
+
+    auto* req = google::protobuf::Arena::CreateMessage<rpcgame::StreamRequest>(_arena.get());
+    req->mutable_done();
+    pb_append_frame(_out, *req);
+    _arena.reset();
+    while (!_done_received) {
+        pump();
+    }
+
+    report(_server_checksums[0], _server_checksums[1]);
+}
+
+std::unique_ptr<pb_client> client;
+
+}
+
+
+void client_connect(std::string address, const client_options& options) {
+    // address format is "host:port"; batches are always columnar and use
+    // one connection
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+    client = std::make_unique<pb_client>(address, options);
+}
+
+void client_send_try(const char* name, size_t name_len, uint64_t count) {
+    client->send_try(name, name_len, count);
+}
+
+void client_finish() {
+    client->finish();
+}
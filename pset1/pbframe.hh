@@ -0,0 +1,104 @@
+#ifndef CS2620_PSET1_PBFRAME_HH
+#define CS2620_PSET1_PBFRAME_HH
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <google/protobuf/arena.h>
+#include "rpcgame.hh"
+#include "rpcgame.pb.h"
+#include "stream.hh"
+
+// Framing for the protobuf transport on plain TCP sockets.
+//
+// A frame is one `StreamRequest` or `StreamResponse` message preceded by
+// two varints, its size and the size of a raw trailer that follows it. A
+// try batch's trailer holds its names, concatenated. Arenas own a `bytes`
+// field's `std::string` but not its character buffer, so sending names in
+// `TryBatch.names` would heap-allocate on both ends for every batch;
+// instead the client appends them straight to the output buffer, and the
+// server reads them in place. Messages are built and parsed in an arena
+// that owns one block reused for every frame, so a steady stream of
+// batches allocates nothing.
+
+constexpr size_t pb_max_frame_size = 64 << 20;
+constexpr size_t pb_arena_block_size = 1 << 16;
+
+
+// pb_arena
+//    A protobuf arena whose first block is embedded. `reset` frees any
+//    overflow blocks and keeps the embedded one.
+
+class pb_arena {
+public:
+    pb_arena()
+        : _arena(options(_block.get())) {
+    }
+
+    google::protobuf::Arena* get() {
+        return &_arena;
+    }
+    void reset() {
+        _arena.Reset();
+    }
+
+private:
+    std::unique_ptr<char[]> _block = std::make_unique<char[]>(pb_arena_block_size);
+    google::protobuf::Arena _arena;
+
+    static google::protobuf::ArenaOptions options(char* block) {
+        google::protobuf::ArenaOptions o;
+        o.initial_block = block;
+        o.initial_block_size = pb_arena_block_size;
+        return o;
+    }
+};
+
+
+// - append `msg` to `out` as a frame with a `trailer_size`-byte trailer,
+//   which the caller appends next
+template <typename Message>
+inline void pb_append_frame(std::string& out, const Message& msg,
+                            size_t trailer_size = 0) {
+    size_t size = msg.ByteSizeLong();
+    put_varint(out, size);
+    put_varint(out, trailer_size);
+    size_t pos = out.size();
+    out.resize(pos + size);
+    msg.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(out.data() + pos));
+}
+
+
+// pb_inbuf
+//    Input buffer for a framed connection.
+
+class pb_inbuf : public stream_inbuf {
+public:
+    // Extract the next complete frame's message and trailer. Both remain
+    // valid until the next `fill`.
+    inline bool next(std::string_view& payload, std::string_view& trailer);
+};
+
+inline bool pb_inbuf::next(std::string_view& payload, std::string_view& trailer) {
+    const char* p = _buf.data() + _head;
+    const char* end = _buf.data() + _tail;
+    uint64_t size, trailer_size;
+    if (!get_varint(p, end, size) || !get_varint(p, end, trailer_size)) {
+        if (_tail - _head >= 20) {
+            throw std::runtime_error("bad frame size");
+        }
+        return false;
+    } else if (size > pb_max_frame_size || trailer_size > pb_max_frame_size) {
+        throw std::runtime_error("frame too large");
+    } else if (size_t(end - p) < size + trailer_size) {
+        return false;
+    }
+    payload = std::string_view(p, size);
+    trailer = std::string_view(p + size, trailer_size);
+    _head = p + size + trailer_size - _buf.data();
+    return true;
+}
+
+#endif
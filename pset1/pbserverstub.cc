@@ -0,0 +1,162 @@
+#include <sys/socket.h>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "pbframe.hh"
+
+// rpcgame server speaking the `RPCGame.Stream` protobuf service over plain
+// TCP. Every connection is served by its own thread and is its own
+// session. A connection delivers its batches in order, so a batch never
+// waits for its turn. Requests are parsed and responses built in the
+// thread's arena; responses accumulate until the thread has consumed all
+// buffered input, then go out in one write.
+
+namespace {
+
+int listen_fd = -1;
+std::atomic<bool> stopping = false;
+
+void write_all(int fd, std::string& out) {
+    size_t pos = 0;
+    while (pos != out.size()) {
+        ssize_t nw = ::write(fd, out.data() + pos, out.size() - pos);
+        if (nw < 0 && errno == EINTR) {
+            continue;
+        } else if (nw <= 0) {
+            throw std::runtime_error(strerror(errno));
+        }
+        pos += nw;
+    }
+    out.clear();
+}
+
+// Process `batch`, whose names are the frame trailer `names`, for
+// `session`, whose next serial is `next_serial`, filling `response`
+void serve_try_batch(uint64_t session, uint64_t& next_serial,
+                     const rpcgame::TryBatch& batch, std::string_view names,
+                     rpcgame::TryBatchResponse* response) {
+    thread_local std::vector<prepared_try> tries;
+    size_t n = batch.counts_size();
+    if (batch.name_lens_size() != int(n)) {
+        throw std::runtime_error("bad try batch");
+    }
+    if (batch.serial_base() != next_serial) {
+        throw std::runtime_error("out-of-order try batch");
+    }
+
+    tries.clear();
+    size_t pos = 0;
+    for (size_t i = 0; i != n; ++i) {
+        size_t len = batch.name_lens(i);
+        if (len > names.size() - pos) {
+            throw std::runtime_error("bad try batch");
+        }
+        tries.push_back(prepare_try(names.data() + pos, len, batch.counts(i)));
+        pos += len;
+    }
+    if (pos != names.size()) {
+        throw std::runtime_error("bad try batch");
+    }
+
+    response->set_serial_base(batch.serial_base());
+    auto* values = response->mutable_values();
+    values->Resize(n, 0);
+    server_process_batch(session, batch.serial_base(), tries.data(), n,
+                         values->mutable_data());
+    next_serial += n;
+}
+
+void serve_connection(int fd) {
+    pb_inbuf in;
+    std::string out;
+    pb_arena arena;
+    uint64_t session = 0;           // opened by the first frame
+    uint64_t next_serial = 1;
+    bool closed = false;
+    try {
+        while (in.fill(fd) > 0) {
+            std::string_view payload, trailer;
+            bool done = false;
+            while (in.next(payload, trailer)) {
+                if (session == 0) {
+                    session = server_open_session();
+                }
+                using google::protobuf::Arena;
+                auto* req = Arena::CreateMessage<rpcgame::StreamRequest>(arena.get());
+                auto* resp = Arena::CreateMessage<rpcgame::StreamResponse>(arena.get());
+                if (!req->ParseFromArray(payload.data(), payload.size())) {
+                    throw std::runtime_error("bad frame");
+                }
+                if (req->has_batch()) {
+                    serve_try_batch(session, next_serial, req->batch(),
+                                    trailer, resp->mutable_batch());
+                } else if (req->has_done() && !closed) {
+                    session_summary sum = server_close_session(session);
+                    closed = true;
+                    auto* d = resp->mutable_done();
+                    d->set_client_checksum(sum.client_checksum);
+                    d->set_server_checksum(sum.server_checksum);
+                    done = sum.last;
+                } else {
+                    throw std::runtime_error("unexpected frame");
+                }
+                pb_append_frame(out, *resp);
+                arena.reset();
+            }
+            write_all(fd, out);
+            if (done) {
+                // stop accepting; threads exit as their clients disconnect
+                stopping = true;
+                shutdown(listen_fd, SHUT_RDWR);
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << "connection: " << e.what() << "\n";
+    }
+    close(fd);
+    // a client that disconnects without a done request still finishes its
+    // session, so the server can exit once every expected session ends
+    if (session != 0 && !closed && server_close_session(session).last) {
+        stopping = true;
+        shutdown(listen_fd, SHUT_RDWR);
+    }
+}
+
+}
+
+
+void server_start(std::string address, size_t nthreads) {
+    (void) nthreads;   // one thread per connection
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+    listen_fd = stream_listen(address);
+    std::cout << "Server listening on " << address << "\n" << std::flush;
+
+    std::vector<std::thread> threads;
+    while (!stopping) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        threads.emplace_back(serve_connection, fd);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    close(listen_fd);
+    std::cout << "Server exiting\n";
+}
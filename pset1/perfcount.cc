@@ -0,0 +1,140 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "perfcount.hh"
+
+namespace {
+
+#if defined(__linux__)
+// - return the `raw_syscalls:sys_enter` tracepoint ID, or -1
+long long syscall_tracepoint_id() {
+    for (const char* dir : {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"}) {
+        std::ifstream f(std::string(dir) + "/events/raw_syscalls/sys_enter/id");
+        long long id;
+        if (f >> id) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+int open_counter(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && errno == EACCES) {
+        // perf_event_paranoid 2 forbids counting kernel events
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+#endif
+
+double to_seconds(const timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+}
+
+
+perf_counters::~perf_counters() {
+    for (int fd : _fd) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void perf_counters::start() {
+#if defined(__linux__)
+    _fd[cycles] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    _fd[instructions] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    _fd[cache_misses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    _fd[task_clock] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+    _fd[context_switches] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+    if (long long id = syscall_tracepoint_id(); id >= 0) {
+        _fd[syscalls] = open_counter(PERF_TYPE_TRACEPOINT, id);
+    }
+    for (int fd : _fd) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    getrusage(RUSAGE_SELF, &_ru_start);
+}
+
+void perf_counters::stop() {
+    getrusage(RUSAGE_SELF, &_ru_stop);
+    for (int i = 0; i != ncounters; ++i) {
+        if (_fd[i] < 0) {
+            continue;
+        }
+#if defined(__linux__)
+        ioctl(_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        // value, time enabled, time running; scale if multiplexed
+        uint64_t v[3];
+        if (read(_fd[i], v, sizeof(v)) == ssize_t(sizeof(v)) && v[2] != 0) {
+            _value[i] = double(v[0]) * v[1] / v[2];
+            _valid[i] = true;
+        }
+#endif
+        close(_fd[i]);
+        _fd[i] = -1;
+    }
+
+    if (!_valid[task_clock]) {
+        _value[task_clock] = 1e9 * (to_seconds(_ru_stop.ru_utime) - to_seconds(_ru_start.ru_utime)
+                                    + to_seconds(_ru_stop.ru_stime) - to_seconds(_ru_start.ru_stime));
+        _valid[task_clock] = true;
+    }
+    if (!_valid[context_switches]) {
+        _value[context_switches] = (_ru_stop.ru_nvcsw - _ru_start.ru_nvcsw)
+            + (_ru_stop.ru_nivcsw - _ru_start.ru_nivcsw);
+        _valid[context_switches] = true;
+    }
+}
+
+void perf_counters::report(std::ostream& out, uint64_t ntries) const {
+    double n = ntries ? ntries : 1;
+    auto per_try = [&] (counter_id c, const char* fmt) -> std::string {
+        if (!_valid[c]) {
+            return "n/a";
+        }
+        double v = _value[c] / n;
+        return std::vformat(fmt, std::make_format_args(v));
+    };
+    std::string ipc = "n/a";
+    if (_valid[cycles] && _valid[instructions] && _value[cycles] != 0) {
+        ipc = std::format("{:.2f}", _value[instructions] / _value[cycles]);
+    }
+    out << std::format("perf: {} tries, {} cycles/try, {} instructions/try "
+                       "(IPC {}), {} cache misses/try\n",
+                       ntries, per_try(cycles, "{:.0f}"),
+                       per_try(instructions, "{:.0f}"), ipc,
+                       per_try(cache_misses, "{:.3f}"))
+        << std::format("perf: {} ns CPU/try, {} context switches/try, "
+                       "{} syscalls/try\n",
+                       per_try(task_clock, "{:.1f}"),
+                       per_try(context_switches, "{:.4f}"),
+                       per_try(syscalls, "{:.4f}"));
+}
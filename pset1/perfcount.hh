@@ -0,0 +1,46 @@
+#ifndef CS2620_PSET1_PERFCOUNT_HH
+#define CS2620_PSET1_PERFCOUNT_HH
+#include <sys/resource.h>
+#include <cstdint>
+#include <iosfwd>
+
+// perf_counters
+//    Whole-process event counts between `start` and `stop`, read with
+//    `perf_event_open`: cycles, instructions, and cache misses where the
+//    hardware counters are available, plus the software counters for task
+//    clock and context switches and, if tracefs is readable, the
+//    `raw_syscalls:sys_enter` tracepoint. Counters are inherited by threads
+//    created after `start`; a thread's counts join the total when it exits.
+//
+//    Containers often forbid some or all of these. Counters that fail to
+//    open are reported as "n/a", except that CPU time and context switches
+//    fall back to `getrusage`, which needs no permission.
+
+class perf_counters {
+public:
+    perf_counters() = default;
+    ~perf_counters();
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    void start();
+    void stop();
+
+    // - print per-try figures for `ntries` tries on one line
+    void report(std::ostream& out, uint64_t ntries) const;
+
+private:
+    enum counter_id {
+        cycles, instructions, cache_misses,
+        task_clock, context_switches, syscalls,
+        ncounters
+    };
+
+    int _fd[ncounters] = {-1, -1, -1, -1, -1, -1};
+    double _value[ncounters] = {};
+    bool _valid[ncounters] = {};
+    rusage _ru_start = {};
+    rusage _ru_stop = {};
+};
+
+#endif
@@ -0,0 +1,453 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include "rpcgame.hh"
+
+// rpcg-bench: run rpcg-server/rpcg-client pairs over a grid of settings and
+// write throughput statistics as CSV.
+//
+// Every configuration is a (transport, encoding, input, window, batch,
+// connections) tuple. Each repetition starts a fresh server as a child
+// process, runs the client, and parses its "RPCs per sec" line. Settings a
+// transport ignores are collapsed, so `shm` runs once per input.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+struct config {
+    std::string transport;      // tcp, ct, pb, shm, or udp
+    std::string encoding;
+    std::string input;
+    size_t window;
+    size_t batch;
+    size_t connections;
+
+    auto key() const {
+        return std::tie(transport, encoding, input, window, batch, connections);
+    }
+    bool operator<(const config& x) const {
+        return key() < x.key();
+    }
+};
+
+struct sample_stats {
+    size_t n = 0;
+    double mean = 0;
+    double stddev = 0;
+    double ci95 = 0;            // half-width of the 95% confidence interval
+};
+
+std::vector<std::string> split(const std::string& s, char delim = ',') {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, delim)) {
+        if (!item.empty()) {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+std::vector<size_t> split_sizes(const std::string& s) {
+    std::vector<size_t> out;
+    for (auto& x : split(s)) {
+        out.push_back(from_str_chars<size_t>(x));
+    }
+    return out;
+}
+
+// Two-sided 95% Student t critical values for 1-30 degrees of freedom
+double t_critical(size_t df) {
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (df == 0) {
+        return 0;
+    }
+    return df <= std::size(table) ? table[df - 1] : 1.960;
+}
+
+sample_stats summarize(const std::vector<double>& xs) {
+    sample_stats st;
+    st.n = xs.size();
+    if (st.n == 0) {
+        return st;
+    }
+    for (double x : xs) {
+        st.mean += x;
+    }
+    st.mean /= st.n;
+    if (st.n > 1) {
+        double ss = 0;
+        for (double x : xs) {
+            ss += (x - st.mean) * (x - st.mean);
+        }
+        st.stddev = std::sqrt(ss / (st.n - 1));
+        st.ci95 = t_critical(st.n - 1) * st.stddev / std::sqrt(double(st.n));
+    }
+    return st;
+}
+
+
+// Synthetic inputs. A spec is a file name, `fixed:LEN`, or `uniform:MIN:MAX`
+// (name lengths drawn uniformly from [MIN, MAX]).
+
+constexpr size_t synthetic_lines = 100000;
+
+std::string make_input(const std::string& spec, const std::string& dir) {
+    auto parts = split(spec, ':');
+    size_t lo, hi;
+    if (parts.size() == 2 && parts[0] == "fixed") {
+        lo = hi = from_str_chars<size_t>(parts[1]);
+    } else if (parts.size() == 3 && parts[0] == "uniform") {
+        lo = from_str_chars<size_t>(parts[1]);
+        hi = from_str_chars<size_t>(parts[2]);
+    } else {
+        return spec;
+    }
+    if (lo == 0 || lo > hi) {
+        std::cerr << spec << ": bad name length range\n";
+        exit(1);
+    }
+
+    std::string filename = std::format("{}/{}-{}.txt", dir, lo, hi);
+    std::ofstream out(filename);
+    std::mt19937_64 rng(lo * 1000003 + hi);
+    std::uniform_int_distribution<size_t> len(lo, hi);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::uniform_int_distribution<uint64_t> count(0, 1000000);
+    std::string name;
+    for (size_t i = 0; i != synthetic_lines; ++i) {
+        name.resize(len(rng));
+        for (char& ch : name) {
+            ch = letter(rng);
+        }
+        out << name << ',' << count(rng) << '\n';
+    }
+    if (!out) {
+        std::cerr << filename << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+    return filename;
+}
+
+
+// Child processes
+
+pid_t spawn(const std::vector<std::string>& args, int stdout_fd, int stderr_fd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(stdout_fd, STDOUT_FILENO);
+        dup2(stderr_fd, STDERR_FILENO);
+        std::vector<char*> argv;
+        for (auto& a : args) {
+            argv.push_back(const_cast<char*>(a.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        std::cerr << argv[0] << ": " << strerror(errno) << "\n";
+        _exit(127);
+    } else if (pid < 0) {
+        std::cerr << "fork: " << strerror(errno) << "\n";
+        exit(1);
+    }
+    return pid;
+}
+
+// - create a pipe whose ends close on exec; the child's end is dup'ed
+void make_pipe(int pipefd[2]) {
+    if (pipe(pipefd) != 0) {
+        std::cerr << "pipe: " << strerror(errno) << "\n";
+        exit(1);
+    }
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+}
+
+// - wait up to `timeout` for a server to print "Server listening on" to
+//   `fd`. Every transport prints it once clients can connect. Return false
+//   if the server exits or times out first.
+bool wait_listening(int fd, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::string output;
+    char buf[1024];
+    while (true) {
+        size_t pos = output.find("Server listening on ");
+        if (pos != std::string::npos && (pos == 0 || output[pos - 1] == '\n')) {
+            return true;
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        pollfd pfd{fd, POLLIN, 0};
+        if (left <= 0ms || poll(&pfd, 1, int(left.count())) <= 0) {
+            return false;
+        }
+        ssize_t nr = read(fd, buf, sizeof(buf));
+        if (nr <= 0) {
+            return false;
+        }
+        output.append(buf, nr);
+    }
+}
+
+// - wait up to `timeout` for `pid` to exit; kill it if it does not
+void reap(pid_t pid, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    int status;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+}
+
+
+struct bench {
+    std::string bindir = ".";
+    uint64_t ntries = 1000000;
+    size_t reps = 5;
+    int port = 29500;
+    int devnull = -1;
+
+    // - run one repetition of `c`; return tries/sec, or a negative
+    //   number on failure
+    double run_once(const config& c, const std::string& input_file);
+};
+
+double bench::run_once(const config& c, const std::string& input_file) {
+    std::string suffix = c.transport == "ct" || c.transport == "pb"
+        ? "-" + c.transport : "";
+    std::vector<std::string> server{bindir + "/rpcg-server" + suffix};
+    std::vector<std::string> client{bindir + "/rpcg-client" + suffix,
+                                    "-n", std::to_string(ntries),
+                                    "-f", input_file};
+    std::string shm_name = std::format("/rpcg-bench-{}", getpid());
+    ++port;
+    if (c.transport == "shm") {
+        shm_unlink(shm_name.c_str());
+        server.insert(server.end(), {"-s", shm_name});
+        client.insert(client.end(), {"-h", "shm:" + shm_name});
+    } else if (c.transport == "udp") {
+        server.insert(server.end(), {"-u", "-p", std::to_string(port)});
+        client.insert(client.end(), {"-h", std::format("udp:localhost:{}", port),
+                                     "-w", std::to_string(c.window),
+                                     "-b", std::to_string(c.batch)});
+    } else {
+        server.insert(server.end(), {"-p", std::to_string(port)});
+        client.insert(client.end(), {"-h", std::format("localhost:{}", port),
+                                     "-w", std::to_string(c.window),
+                                     "-b", std::to_string(c.batch),
+                                     "-k", std::to_string(c.connections)});
+        // the protobuf client has a single encoding
+        if (c.transport != "pb") {
+            client.insert(client.end(), {"-e", c.encoding});
+        }
+    }
+
+    // The server keeps writing to its pipe, so the read end stays open
+    // until it exits. Its remaining output is a few lines.
+    int serverfd[2];
+    make_pipe(serverfd);
+    pid_t server_pid = spawn(server, serverfd[1], devnull);
+    close(serverfd[1]);
+    if (!wait_listening(serverfd[0], 5s)) {
+        std::cerr << server[0] << ": server did not start\n";
+        reap(server_pid, 0ms);
+        close(serverfd[0]);
+        return -1;
+    }
+
+    int pipefd[2];
+    make_pipe(pipefd);
+    pid_t client_pid = spawn(client, pipefd[1], pipefd[1]);
+    close(pipefd[1]);
+
+    // collect the client's report
+    std::string output, line;
+    char buf[8192];
+    ssize_t nr;
+    while ((nr = read(pipefd[0], buf, sizeof(buf))) > 0) {
+        output.append(buf, nr);
+    }
+    close(pipefd[0]);
+    int status;
+    waitpid(client_pid, &status, 0);
+    reap(server_pid, 2s);
+    close(serverfd[0]);
+
+    bool matched = false;
+    double rate = -1;
+    std::istringstream in(output);
+    while (std::getline(in, line)) {
+        if (line == "match: true") {
+            matched = true;
+        } else if (line.starts_with("sent ") && line.ends_with(" RPCs per sec")) {
+            rate = std::strtod(line.c_str() + 5, nullptr);
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !matched) {
+        std::cerr << client[0] << ": run failed\n"
+                  << output.substr(output.size() - std::min(output.size(), size_t(500)));
+        return -1;
+    }
+    return rate;
+}
+
+void usage() {
+    std::cerr << "Usage: rpcg-bench [-B BINDIR] [-o CSV] [-n TRIES] [-r REPS]\n"
+              << "    [-t tcp,ct,pb,shm,udp] [-e plain,dict,columnar] [-w WINDOWS]\n"
+              << "    [-b BATCHES] [-k CONNECTIONS] [-p FIRST_PORT]\n"
+              << "    [-i lines.txt,fixed:LEN,uniform:MIN:MAX]\n";
+    exit(1);
+}
+
+}
+
+
+int main(int argc, char* const argv[]) {
+    bench b;
+    if (const char* slash = strrchr(argv[0], '/')) {
+        b.bindir = std::string(argv[0], slash - argv[0]);
+    }
+    std::string outfile;
+    auto transports = split("tcp");
+    auto encodings = split("dict");
+    auto inputs = split("lines.txt");
+    std::vector<size_t> windows{0}, batches{0}, connections{1};
+
+    int ch;
+    while ((ch = getopt(argc, argv, "B:o:n:r:t:e:w:b:k:i:p:")) != -1) {
+        if (ch == 'B') {
+            b.bindir = optarg;
+        } else if (ch == 'o') {
+            outfile = optarg;
+        } else if (ch == 'n') {
+            b.ntries = from_str_chars<uint64_t>(optarg);
+        } else if (ch == 'r') {
+            b.reps = std::max(from_str_chars<size_t>(optarg), size_t(1));
+        } else if (ch == 'p') {
+            b.port = from_str_chars<uint16_t>(optarg);
+        } else if (ch == 't') {
+            transports = split(optarg);
+        } else if (ch == 'e') {
+            encodings = split(optarg);
+        } else if (ch == 'w') {
+            windows = split_sizes(optarg);
+        } else if (ch == 'b') {
+            batches = split_sizes(optarg);
+        } else if (ch == 'k') {
+            connections = split_sizes(optarg);
+        } else if (ch == 'i') {
+            inputs = split(optarg);
+        } else {
+            usage();
+        }
+    }
+
+    // expand the grid, collapsing settings a transport ignores
+    std::set<config> configs;
+    for (auto& t : transports) {
+        if (t != "tcp" && t != "ct" && t != "pb" && t != "shm" && t != "udp") {
+            std::cerr << "-t: unknown transport " << t << "\n";
+            usage();
+        }
+        for (auto& e : encodings)
+            for (auto& i : inputs)
+                for (size_t w : windows)
+                    for (size_t bs : batches)
+                        for (size_t k : connections) {
+                            if (t == "shm") {
+                                configs.insert({t, "-", i, 0, 0, 1});
+                            } else if (t == "ct" || t == "udp") {
+                                configs.insert({t, "columnar", i, w, bs, 1});
+                            } else if (t == "pb") {
+                                configs.insert({t, "protobuf", i, w, bs, 1});
+                            } else {
+                                configs.insert({t, e, i, w, bs, k});
+                            }
+                        }
+    }
+
+    char tmpl[] = "/tmp/rpcg-bench-XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        std::cerr << tmpl << ": " << strerror(errno) << "\n";
+        exit(1);
+    }
+    std::string tmpdir = tmpl;
+    b.devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    // The CSV is rewritten after every configuration rather than held open,
+    // so its descriptor never leaks into the children.
+    std::string csv = "transport,encoding,input,window,batch,connections,"
+        "tries,reps,failures,mean_rps,stddev_rps,ci95_low_rps,ci95_high_rps\n";
+    if (outfile.empty()) {
+        std::cout << csv;
+    }
+
+    std::map<std::string, std::string> input_files;
+    for (auto& c : configs) {
+        auto it = input_files.find(c.input);
+        if (it == input_files.end()) {
+            it = input_files.emplace(c.input, make_input(c.input, tmpdir)).first;
+        }
+        const std::string& input_file = it->second;
+        std::vector<double> rates;
+        size_t failures = 0;
+        for (size_t r = 0; r != b.reps; ++r) {
+            double rate = b.run_once(c, input_file);
+            if (rate >= 0) {
+                rates.push_back(rate);
+            } else {
+                ++failures;
+            }
+        }
+        auto st = summarize(rates);
+        auto row = std::format("{},{},{},{},{},{},{},{},{},{:.0f},{:.0f},{:.0f},{:.0f}\n",
+                               c.transport, c.encoding, c.input, c.window,
+                               c.batch, c.connections, b.ntries, st.n, failures,
+                               st.mean, st.stddev, st.mean - st.ci95,
+                               st.mean + st.ci95);
+        csv += row;
+        if (outfile.empty()) {
+            std::cout << row << std::flush;
+        } else if (!(std::ofstream(outfile) << csv)) {
+            std::cerr << outfile << ": " << strerror(errno) << "\n";
+            exit(1);
+        }
+        std::cerr << std::format("{} {} {} w={} b={} k={}: {:.0f} +/- {:.0f} RPCs/sec\n",
+                                 c.transport, c.encoding, c.input, c.window,
+                                 c.batch, c.connections, st.mean, st.ci95);
+    }
+
+    for (auto& [spec, file] : input_files) {
+        if (file != spec) {
+            unlink(file.c_str());
+        }
+    }
+    rmdir(tmpdir.c_str());
+}
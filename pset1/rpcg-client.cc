@@ -1,4 +1,6 @@
 #include <sys/mman.h>
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <charconv>
 #include <chrono>
@@ -7,15 +9,121 @@
 #include <memory>
 #include <numeric>
 #include <sstream>
+#include <thread>
 #include <vector>
 #include <fcntl.h>
+#include <getopt.h>
 #include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HAVE_AVX2_DISPATCH 1
+#else
+# define HAVE_AVX2_DISPATCH 0
+#endif
+#include "perfcount.hh"
 #include "rpcgame.hh"
 
 using steady_time_point = std::chrono::time_point<std::chrono::steady_clock>;
 
 namespace {
 
+// Input parsing. Each line of the input file is `name,count`; other lines
+// are skipped. Lines are stored as offsets into the mapped file.
+
+struct input_line {
+    uint32_t name_offset;
+    uint32_t name_len;
+    uint64_t count;
+};
+
+// files at least this large per thread are parsed in parallel
+constexpr size_t parallel_chunk_size = size_t(32) << 20;
+
+// - return the first ',' or '\n' in `[s, end)`, or `end`
+[[gnu::always_inline]] inline const char* find_field_end(const char* s,
+                                                         const char* end) {
+#if defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(','), nl = _mm_set1_epi8('\n');
+    for (; end - s >= 16; s += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+        uint32_t m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, comma),
+                                                    _mm_cmpeq_epi8(v, nl)));
+        if (m != 0) {
+            return s + std::countr_zero(m);
+        }
+    }
+#endif
+    while (s != end && *s != '\n' && *s != ',') {
+        ++s;
+    }
+    return s;
+}
+
+#if HAVE_AVX2_DISPATCH
+// - the same, comparing 32 bytes at a time. Call only if the CPU has AVX2.
+[[gnu::target("avx2")]]
+inline const char* find_field_end_avx2(const char* s, const char* end) {
+    const __m256i comma = _mm256_set1_epi8(','), nl = _mm256_set1_epi8('\n');
+    for (; end - s >= 32; s += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+        uint32_t m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, comma),
+                                                          _mm256_cmpeq_epi8(v, nl)));
+        if (m != 0) {
+            return s + std::countr_zero(m);
+        }
+    }
+    return find_field_end(s, end);
+}
+#endif
+
+// - parse the lines in `[s, end)`, which starts at a line boundary, and
+//   append them to `out`, finding fields with `Find`
+template <const char* (*Find)(const char*, const char*)>
+[[gnu::always_inline]] inline void parse_lines_with(const char* base, const char* s,
+                                                    const char* end,
+                                                    std::vector<input_line>& out) {
+    while (s != end) {
+        const char* line = s;
+        s = Find(s, end);
+        if (s == end) {
+            break;
+        } else if (*s == '\n') {
+            ++s;
+            continue;
+        }
+        const char* comma = s;
+        uint64_t value;
+        auto [next, ec] = std::from_chars(comma + 1, end, value, 10);
+        if (ec == std::errc()) {
+            out.emplace_back(uint32_t(line - base), uint32_t(comma - line), value);
+        }
+        auto nl = reinterpret_cast<const char*>(memchr(next, '\n', end - next));
+        s = nl ? nl + 1 : end;
+    }
+}
+
+#if HAVE_AVX2_DISPATCH
+[[gnu::target("avx2")]]
+void parse_lines_avx2(const char* base, const char* s, const char* end,
+                      std::vector<input_line>& out) {
+    parse_lines_with<find_field_end_avx2>(base, s, end, out);
+}
+#endif
+
+// - parse the lines in `[s, end)` with the widest field search the CPU
+//   supports: AVX2 if available at run time, otherwise SSE2 on x86
+void parse_lines(const char* base, const char* s, const char* end,
+                 std::vector<input_line>& out) {
+#if HAVE_AVX2_DISPATCH
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        parse_lines_avx2(base, s, end, out);
+        return;
+    }
+#endif
+    parse_lines_with<find_field_end>(base, s, end, out);
+}
+
 class rpc_client {
 public:
     rpc_client(const char* filename);
@@ -34,15 +142,10 @@ private:
     int _inputfd;
     size_t _inputlen;
     void* _inputdata;
-    struct input_line {
-        const char* name;
-        size_t name_len;
-        size_t count;
-    };
     std::vector<input_line> _inputs;
     uint64_t _inputindex = 0;
 
-    XXH3_state_t* _ctx[2];
+    checksum_accumulator _checksum[2];
     bool _done = false;
 
     NONCOPYABLE(rpc_client);
@@ -59,57 +162,62 @@ rpc_client::rpc_client(const char* filename) {
     if (sz == -1) {
         std::cerr << filename << ": " << strerror(errno) << "\n";
         exit(1);
-    } else if (sz > SIZE_MAX) {
+    } else if (uint64_t(sz) > UINT32_MAX) {
+        // `input_line` stores 32-bit offsets
         std::cerr << filename << ": File too large\n";
         exit(1);
     }
     _inputlen = sz;
 
-    _inputdata = mmap(nullptr, _inputlen, PROT_READ, MAP_SHARED, _inputfd, 0);
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    _inputdata = mmap(nullptr, _inputlen, PROT_READ, flags, _inputfd, 0);
     if (_inputdata == MAP_FAILED) {
         std::cerr << "mmap " << filename << ": " << strerror(errno) << "\n";
         exit(1);
     }
 
-    const char* s = reinterpret_cast<char*>(_inputdata);
-    const char* efile = s + sz;
-    while (s != efile) {
-        const char* line = s;
-        while (s != efile && *s != '\n' && *s != ',') {
-            ++s;
-        }
-        if (s == efile) {
-            continue;
-        } else if (*s == '\n') {
-            ++s;
-            continue;
-        }
-        const char* comma = s;
-        uint64_t value;
-        auto [next, ec] = std::from_chars(comma + 1, efile, value, 10);
-        if (ec == std::errc()) {
-            _inputs.emplace_back(line, size_t(comma - line), value);
-        }
-        s = next;
-        while (s != efile && *s != '\n') {
-            ++s;
-        }
-        if (s != efile) {
-            ++s;
-        }
+    // the scan reads the file front to back
+    madvise(_inputdata, _inputlen, MADV_SEQUENTIAL);
+    const char* base = reinterpret_cast<char*>(_inputdata);
+    const char* efile = base + _inputlen;
+
+    // large files are split at line boundaries and parsed in parallel
+    size_t nthreads = std::min(size_t(std::thread::hardware_concurrency()),
+                               _inputlen / parallel_chunk_size);
+    if (nthreads <= 1) {
+        parse_lines(base, base, efile, _inputs);
+        return;
+    }
+    std::vector<const char*> bounds{base};
+    for (size_t i = 1; i != nthreads; ++i) {
+        const char* b = std::max(base + _inputlen / nthreads * i, bounds.back());
+        auto nl = reinterpret_cast<const char*>(memchr(b, '\n', efile - b));
+        bounds.push_back(nl ? nl + 1 : efile);
+    }
+    bounds.push_back(efile);
+    std::vector<std::vector<input_line>> parts(nthreads);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != nthreads; ++i) {
+        threads.emplace_back(parse_lines, base, bounds[i], bounds[i + 1],
+                             std::ref(parts[i]));
+    }
+    size_t total = 0;
+    for (size_t i = 0; i != nthreads; ++i) {
+        threads[i].join();
+        total += parts[i].size();
+    }
+    _inputs.reserve(total);
+    for (auto& part : parts) {
+        _inputs.insert(_inputs.end(), part.begin(), part.end());
     }
-
-    _ctx[0] = XXH3_createState();
-    XXH3_64bits_reset(_ctx[0]);
-    _ctx[1] = XXH3_createState();
-    XXH3_64bits_reset(_ctx[1]);
 }
 
 rpc_client::~rpc_client() {
     munmap(_inputdata, _inputlen);
     close(_inputfd);
-    XXH3_freeState(_ctx[0]);
-    XXH3_freeState(_ctx[1]);
 }
 
 void rpc_client::run(uint64_t n, steady_time_point timestamp) {
@@ -121,11 +229,12 @@ void rpc_client::run(uint64_t n, steady_time_point timestamp) {
         if (_inputindex == _inputs.size()) {
             _inputindex = 0;
         }
+        const char* name = reinterpret_cast<const char*>(_inputdata) + line.name_offset;
 
-        XXH3_64bits_update(_ctx[client_type], line.name, line.name_len);
-        XXH3_64bits_update_uint64(_ctx[client_type], line.count);
+        _checksum[client_type].append(name, line.name_len);
+        _checksum[client_type].append_uint64(line.count);
 
-        client_send_try(line.name, line.name_len, line.count);
+        client_send_try(name, line.name_len, line.count);
 
         ++i;
         if (i % 10000 == 0) {
@@ -140,12 +249,12 @@ void rpc_client::run(uint64_t n, steady_time_point timestamp) {
 
 inline void rpc_client::process_response(uint64_t value) {
     assert(!_done);
-    XXH3_64bits_update_uint64(_ctx[server_type], value);
+    _checksum[server_type].append_uint64(value);
 }
 
 inline std::string rpc_client::checksum(endpoint ep) {
     _done = true;
-    return XXH3_64bits_hexdigest(_ctx[ep]);
+    return _checksum[ep].hexdigest();
 }
 
 std::unique_ptr<rpc_client> rpcc;
@@ -174,21 +283,54 @@ int main(int argc, char* const argv[]) {
     std::string address = "localhost:29381";
     uint64_t n = 100000;
     const char* filename = "lines.txt";
+    client_options options;
+    bool perf = false;
+    static const option long_options[] = {
+        {"perf", no_argument, nullptr, 'P'},
+        {nullptr, 0, nullptr, 0}
+    };
     int ch;
-    while ((ch = getopt(argc, argv, "h:n:f:")) != -1) {
-        if (ch == 'h') {
+    while ((ch = getopt_long(argc, argv, "h:n:f:e:w:b:k:L:", long_options, nullptr)) != -1) {
+        if (ch == 'P') {
+            perf = true;
+        } else if (ch == 'h') {
             address = optarg;
         } else if (ch == 'n') {
             n = from_str_chars<uint64_t>(optarg);
         } else if (ch == 'f') {
             filename = optarg;
+        } else if (ch == 'w') {
+            options.window = from_str_chars<size_t>(optarg);
+        } else if (ch == 'b') {
+            options.batch = from_str_chars<size_t>(optarg);
+        } else if (ch == 'k') {
+            options.connections = from_str_chars<size_t>(optarg);
+        } else if (ch == 'L') {
+            options.latency_csv = optarg;
+        } else if (ch == 'e') {
+            if (strcmp(optarg, "plain") == 0) {
+                options.encoding = batch_encoding::plain;
+            } else if (strcmp(optarg, "dict") == 0) {
+                options.encoding = batch_encoding::dict;
+            } else if (strcmp(optarg, "columnar") == 0) {
+                options.encoding = batch_encoding::columnar;
+            } else {
+                std::cerr << "-e: expected `plain`, `dict`, or `columnar`\n";
+                exit(1);
+            }
         }
     }
 
     rpcc = std::make_unique<rpc_client>(filename);
 
-    client_connect(address);
+    // Counters are inherited only by threads created after `start`, so
+    // start them before `client_connect` creates the transport's threads
+    perf_counters counters;
+    if (perf) {
+        counters.start();
+    }
 
+    client_connect(address, options);
     const auto start_time = std::chrono::steady_clock::now();
 
     rpcc->run(n, start_time);
@@ -196,7 +338,13 @@ int main(int argc, char* const argv[]) {
     client_finish();
 
     const auto end_time = std::chrono::steady_clock::now();
+    if (perf) {
+        counters.stop();
+    }
     const std::chrono::duration<double> diff = end_time - start_time;
     std::cerr << std::format("sent {} RPCs in {:.09f} sec\n", n, diff.count())
         << std::format("sent {:.0f} RPCs per sec\n", n / diff.count());
+    if (perf) {
+        counters.report(std::cerr, n);
+    }
 }
@@ -1,78 +1,489 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
-#include <condition_variable>
+#include <chrono>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
 #include <unistd.h>
 #include <getopt.h>
+#include "perfcount.hh"
 #include "rpcgame.hh"
 
 namespace {
 
-class rpc_server {
+// A sequencer admits callers one at a time, in serial order.
+//
+// Slots form a ring indexed by serial. A caller waits on the slot for its own
+// serial, and `release(s)` hands the turn to serial `s + 1` by writing that
+// slot only. Threads waiting for other serials are not woken. Waiters spin
+// briefly before parking, since the handoff is usually quick.
+//
+// `wait` returns false if `serial`'s turn has already passed, which happens
+// only to re-sent batches.
+//
+// `cancel` starts a new epoch. A caller that waits in an older epoch throws
+// instead of waiting on, which frees the workers held by batches whose
+// client has reconnected and will re-send them.
+class sequencer {
+public:
+    explicit sequencer(uint64_t first = 1);
+
+    uint64_t epoch() const {
+        return _epoch.load();
+    }
+
+    inline bool wait(uint64_t serial, uint64_t epoch);
+    inline void release(uint64_t serial);
+    void cancel();
+
+private:
+    static constexpr size_t nslots = 256;
+    static constexpr int spin_limit = 128;
+
+    struct alignas(64) slot {
+        std::atomic<uint64_t> turn = 0;   // serial currently admitted here
+        std::atomic<uint32_t> parked = 0; // number of threads in `wake.wait`
+        std::atomic<uint32_t> wake = 0;   // bumped to wake parked threads
+    };
+    slot _slots[nslots];
+    std::atomic<uint64_t> _epoch = 0;
+
+    inline void wake(slot& s);
+
+    NONCOPYABLE(sequencer);
+};
+
+sequencer::sequencer(uint64_t first) {
+    _slots[first % nslots].turn.store(first, std::memory_order_relaxed);
+}
+
+inline bool sequencer::wait(uint64_t serial, uint64_t epoch) {
+    slot& s = _slots[serial % nslots];
+    uint64_t turn = s.turn.load(std::memory_order_acquire);
+    for (int spin = 0; turn < serial && spin != spin_limit; ++spin) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+        turn = s.turn.load(std::memory_order_acquire);
+    }
+    while (turn < serial) {
+        // `parked`, `wake`, `turn`, and `_epoch` are all sequentially
+        // consistent, so either `release` and `cancel` see our
+        // registration, or we see their new `turn` or `_epoch`
+        s.parked.fetch_add(1);
+        uint32_t w = s.wake.load();
+        turn = s.turn.load();
+        if (turn < serial && _epoch.load() == epoch) {
+            s.wake.wait(w);
+            turn = s.turn.load();
+        }
+        s.parked.fetch_sub(1);
+        if (turn < serial && _epoch.load() != epoch) {
+            throw std::runtime_error("batch canceled by session resume");
+        }
+    }
+    return turn == serial;
+}
+
+inline void sequencer::release(uint64_t serial) {
+    slot& s = _slots[(serial + 1) % nslots];
+    s.turn.store(serial + 1);
+    wake(s);
+}
+
+void sequencer::cancel() {
+    _epoch.fetch_add(1);
+    for (slot& s : _slots) {
+        wake(s);
+    }
+}
+
+inline void sequencer::wake(slot& s) {
+    if (s.parked.load() != 0) {
+        s.wake.fetch_add(1);
+        s.wake.notify_all();
+    }
+}
+
+
+// A session is one client's game: its own serial space, running count, and
+// checksums. Sessions are independent, so their batches commit in parallel.
+//
+// A client that reconnects re-sends every batch it has no response for, so
+// a batch may arrive twice. Serials below `_committed` are answered from
+// the replay buffer; a duplicate of a batch still in progress loses the
+// `_claimed` race for its first serial and waits on `_committed` for the
+// original. Resuming cancels the batches still waiting for their turn, so
+// the original and its duplicate never both hold a worker.
+class game_session {
 public:
-    rpc_server();
-    ~rpc_server();
+    game_session() = default;
 
-    inline uint64_t process_try(uint64_t serial,
-                                const char* name, size_t name_len,
-                                uint64_t value);
+    inline void process_batch(uint64_t serial_base, const prepared_try* tries,
+                              size_t n, uint64_t* values);
+    inline void process_batch_in_order(uint64_t serial_base,
+                                       const prepared_try* tries, size_t n,
+                                       uint64_t* values);
+    inline bool resume(uint64_t serial);
 
     enum endpoint {
         client_type = 0, server_type = 1
     };
     inline std::string checksum(endpoint);
 
+    uint64_t count() const {
+        return _count;
+    }
+
+    const std::chrono::steady_clock::time_point opened =
+        std::chrono::steady_clock::now();
+
+    // Batches in progress. `rpc_server` enters a batch while the session
+    // is still in its table, so once the session is removed, `wait_idle`
+    // returns after the last batch leaves.
+    void enter() {
+        _active.fetch_add(1, std::memory_order_relaxed);
+    }
+    inline void leave();
+    inline void wait_idle() const;
+
 private:
-    XXH3_state_t* _ctx[2];
-    uint64_t _count;
-    std::string _hash[2];
-    uint64_t _want_serial = 1;
+    checksum_accumulator _checksum[2];
+    uint64_t _count = 0;
     bool _done = false;
 
-    std::mutex _mutex;
-    std::condition_variable _cv;
+    sequencer _seq;
+    std::atomic<uint64_t> _claimed = 1;     // first serial no batch has claimed
+    std::atomic<uint64_t> _committed = 1;   // first serial not yet committed
+    std::unique_ptr<uint64_t[]> _replay =   // responses by serial % capacity
+        std::make_unique<uint64_t[]>(replay_capacity);
+    std::atomic<uint32_t> _active = 0;      // batches between enter and leave
 
-    NONCOPYABLE(rpc_server);
+    inline void commit(uint64_t serial_base, const prepared_try* tries,
+                       size_t n, uint64_t* values);
+    inline void replay(uint64_t serial_base, size_t n, uint64_t* values) const;
+
+    NONCOPYABLE(game_session);
 };
 
-rpc_server::rpc_server() {
-    _ctx[0] = XXH3_createState();
-    XXH3_64bits_reset(_ctx[0]);
-    _ctx[1] = XXH3_createState();
-    XXH3_64bits_reset(_ctx[1]);
+// The name hashes in `tries` do not depend on `_count`, so callers compute
+// them beforehand; only the response arithmetic and the checksum updates
+// wait for the batch's turn.
+void game_session::process_batch(uint64_t serial_base, const prepared_try* tries,
+                                 size_t n, uint64_t* values) {
+    uint64_t epoch = _seq.epoch();
+    uint64_t committed = _committed.load(std::memory_order_acquire);
+    if (serial_base < committed) {
+        size_t k = std::min(n, size_t(committed - serial_base));
+        replay(serial_base, k, values);
+        serial_base += k;
+        tries += k;
+        values += k;
+        n -= k;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    uint64_t expected = serial_base;
+    if (!_seq.wait(serial_base, epoch)
+        || !_claimed.compare_exchange_strong(expected, serial_base + n)) {
+        // a duplicate: wait for the original to commit, then replay it
+        uint64_t c;
+        while ((c = _committed.load(std::memory_order_acquire)) <= serial_base) {
+            _committed.wait(c, std::memory_order_acquire);
+        }
+        process_batch(serial_base, tries, n, values);
+        return;
+    }
+    // pairs with the fence in `replay`
+    std::atomic_thread_fence(std::memory_order_release);
+    commit(serial_base, tries, n, values);
+
+    _committed.store(serial_base + n, std::memory_order_release);
+    _committed.notify_all();
+    _seq.release(serial_base + n - 1);
 }
 
-rpc_server::~rpc_server() {
-    XXH3_freeState(_ctx[0]);
-    XXH3_freeState(_ctx[1]);
+// A single-threaded server delivers each session's batches in serial
+// order, so it needs neither the sequencer nor duplicate handling.
+void game_session::process_batch_in_order(uint64_t serial_base,
+                                          const prepared_try* tries,
+                                          size_t n, uint64_t* values) {
+    uint64_t committed = _committed.load(std::memory_order_relaxed);
+    if (serial_base != committed) {
+        throw std::invalid_argument("out-of-order batch");
+    }
+    _claimed.store(serial_base + n, std::memory_order_relaxed);
+    commit(serial_base, tries, n, values);
+    _committed.store(serial_base + n, std::memory_order_relaxed);
 }
 
-uint64_t rpc_server::process_try(uint64_t serial,
-                                 const char* name, size_t name_len,
-                                 uint64_t value) {
-    std::unique_lock<std::mutex> guard(_mutex);
-    _cv.wait(guard, [this, serial] () { return serial == _want_serial; });
-    ++_want_serial;
+inline void game_session::commit(uint64_t serial_base, const prepared_try* tries,
+                                 size_t n, uint64_t* values) {
     assert(!_done);
+    for (size_t i = 0; i != n; ++i) {
+        const prepared_try& t = tries[i];
+        _checksum[client_type].append(t.name, t.name_len);
+        _checksum[client_type].append_uint64(t.count);
+
+        // compute response
+        uint64_t response = t.name_hash + t.count + _count;
+        ++_count;
 
-    XXH3_64bits_update(_ctx[client_type], name, name_len);
-    XXH3_64bits_update_uint64(_ctx[client_type], value);
+        _checksum[server_type].append_uint64(response);
+        values[i] = response;
+        std::atomic_ref<uint64_t>(_replay[(serial_base + i) % replay_capacity])
+            .store(response, std::memory_order_relaxed);
+    }
+}
 
-    // compute response
-    uint64_t response = XXH3_64bits(name, name_len) + value + _count;
-    ++_count;
+inline void game_session::replay(uint64_t serial_base, size_t n,
+                                 uint64_t* values) const {
+    // A batch claiming serials a capacity later may overwrite these slots
+    // meanwhile. Check its claim afterwards, as in a seqlock: if we read
+    // one of its values, the fences make its claim visible.
+    for (size_t i = 0; i != n; ++i) {
+        values[i] = std::atomic_ref<uint64_t>(_replay[(serial_base + i) % replay_capacity])
+            .load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (_claimed.load(std::memory_order_relaxed) > serial_base + replay_capacity) {
+        throw std::out_of_range("re-sent serial no longer in replay buffer");
+    }
+}
 
-    XXH3_64bits_update_uint64(_ctx[server_type], response);
+inline bool game_session::resume(uint64_t serial) {
+    uint64_t committed = _committed.load(std::memory_order_acquire);
+    if (serial > committed || committed - serial > replay_capacity) {
+        return false;
+    }
+    // the client closed its old connections and will re-send everything
+    // from `serial` on
+    _seq.cancel();
+    return true;
+}
 
-    guard.unlock();
-    _cv.notify_all();
-    return response;
+inline void game_session::leave() {
+    // release: the batch's writes happen before `wait_idle` returns
+    if (_active.fetch_sub(1, std::memory_order_release) == 1) {
+        _active.notify_all();
+    }
 }
 
-inline std::string rpc_server::checksum(endpoint ep) {
+inline void game_session::wait_idle() const {
+    uint32_t active;
+    while ((active = _active.load(std::memory_order_acquire)) != 0) {
+        _active.wait(active, std::memory_order_acquire);
+    }
+}
+
+inline std::string game_session::checksum(endpoint ep) {
     _done = true;
-    return XXH3_64bits_hexdigest(_ctx[ep]);
+    return _checksum[ep].hexdigest();
+}
+
+
+// The session table. Batches look their session up under a shared lock
+// and enter it; opening and closing sessions take the lock exclusively.
+// Closing a session removes it from the table, then waits for the batches
+// that entered it to leave before reading its checksums. Sessions are
+// shared, so a leaving batch may still touch its session after that.
+//
+// The server also sizes flow-control credits. Its budget is the number of
+// tries it can commit in `credit_delay` at its recent rate; each open
+// session gets an equal share, and while more tries than the budget are
+// queued in `process_batch`, shares shrink in proportion.
+//
+// A single-threaded transport makes every call from one thread and sends
+// each session's batches in order. Its batches skip the lock, the
+// sequencer, and the credit accounting, which it does not use.
+class rpc_server {
+public:
+    rpc_server() = default;
+
+    void set_single_threaded() {
+        _single_threaded = true;
+    }
+
+    void expect_sessions(size_t n) {
+        _expected = n;
+    }
+    size_t expected_sessions() const {
+        return _expected;
+    }
+
+    uint64_t open_session();
+    inline std::shared_ptr<game_session> find_session(uint64_t id);
+    inline std::shared_ptr<game_session> enter_session(uint64_t id);
+    inline void process_batch(uint64_t id, uint64_t serial_base,
+                              const prepared_try* tries, size_t n,
+                              uint64_t* values);
+    uint32_t credits();
+    session_summary close_session(uint64_t id);
+
+    // - return the number of tries in closed sessions
+    uint64_t total_count() const {
+        return _total_count;
+    }
+
+private:
+    static constexpr auto credit_delay = std::chrono::milliseconds(5);
+    static constexpr double min_credit_budget = 4096;
+    static constexpr uint32_t min_credits = 64;
+    static constexpr uint32_t max_credits = 1 << 20;
+    static constexpr auto rate_interval = std::chrono::milliseconds(1);
+
+    std::shared_mutex _mutex;
+    std::unordered_map<uint64_t, std::shared_ptr<game_session>> _sessions;
+    uint64_t _next_id = 1;
+    size_t _expected = 1;
+    bool _single_threaded = false;
+    size_t _closed = 0;
+    uint64_t _total_count = 0;
+    std::chrono::steady_clock::time_point _first_opened;
+
+    std::atomic<size_t> _nsessions = 0;
+    std::atomic<uint64_t> _queued = 0;      // tries inside `process_batch`
+    std::atomic<uint64_t> _committed = 0;   // tries that left it
+    std::atomic<double> _rate = 0;          // smoothed commits/sec
+    std::atomic<int64_t> _rate_time = 0;    // steady_clock ticks of last sample
+    std::mutex _rate_mutex;                 // held while sampling
+    uint64_t _rate_committed = 0;
+
+    NONCOPYABLE(rpc_server);
+};
+
+uint64_t rpc_server::open_session() {
+    std::unique_lock<std::shared_mutex> guard(_mutex);
+    uint64_t id = _next_id++;
+    auto& sess = _sessions[id];
+    sess = std::make_shared<game_session>();
+    if (id == 1) {
+        _first_opened = sess->opened;
+    }
+    ++_nsessions;
+    return id;
+}
+
+inline std::shared_ptr<game_session> rpc_server::find_session(uint64_t id) {
+    std::shared_lock<std::shared_mutex> guard(_mutex);
+    auto it = _sessions.find(id);
+    if (it == _sessions.end()) {
+        throw std::out_of_range("unknown session");
+    }
+    return it->second;
+}
+
+// - find session `id` and enter it before it can leave the table
+inline std::shared_ptr<game_session> rpc_server::enter_session(uint64_t id) {
+    std::shared_lock<std::shared_mutex> guard(_mutex);
+    auto it = _sessions.find(id);
+    if (it == _sessions.end()) {
+        throw std::out_of_range("unknown session");
+    }
+    it->second->enter();
+    return it->second;
+}
+
+inline void rpc_server::process_batch(uint64_t id, uint64_t serial_base,
+                                      const prepared_try* tries, size_t n,
+                                      uint64_t* values) {
+    if (_single_threaded) {
+        auto it = _sessions.find(id);
+        if (it == _sessions.end()) {
+            throw std::out_of_range("unknown session");
+        }
+        it->second->process_batch_in_order(serial_base, tries, n, values);
+        return;
+    }
+    std::shared_ptr<game_session> sess = enter_session(id);
+    _queued.fetch_add(n, std::memory_order_relaxed);
+    try {
+        sess->process_batch(serial_base, tries, n, values);
+    } catch (...) {
+        _queued.fetch_sub(n, std::memory_order_relaxed);
+        sess->leave();
+        throw;
+    }
+    _queued.fetch_sub(n, std::memory_order_relaxed);
+    _committed.fetch_add(n, std::memory_order_relaxed);
+    sess->leave();
+}
+
+uint32_t rpc_server::credits() {
+    // sample the commit rate about once per `rate_interval`; whichever
+    // thread gets the lock does it
+    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    int64_t then = _rate_time.load(std::memory_order_relaxed);
+    std::chrono::steady_clock::duration elapsed(now - then);
+    if (elapsed >= rate_interval && _rate_mutex.try_lock()) {
+        if (_rate_time.load(std::memory_order_relaxed) == then) {
+            uint64_t committed = _committed.load(std::memory_order_relaxed);
+            double sample = (committed - _rate_committed)
+                / std::chrono::duration<double>(elapsed).count();
+            double rate = _rate.load(std::memory_order_relaxed);
+            _rate.store(then == 0 ? 0 : (rate == 0 ? sample : 0.75 * rate + 0.25 * sample),
+                        std::memory_order_relaxed);
+            _rate_committed = committed;
+            _rate_time.store(now, std::memory_order_relaxed);
+        }
+        _rate_mutex.unlock();
+    }
+
+    double budget = std::max(_rate.load(std::memory_order_relaxed)
+                             * std::chrono::duration<double>(credit_delay).count(),
+                             min_credit_budget);
+    double share = budget / std::max(_nsessions.load(std::memory_order_relaxed), size_t(1));
+    double queued = _queued.load(std::memory_order_relaxed);
+    if (queued > budget) {
+        share *= budget / queued;
+    }
+    return std::clamp(uint32_t(std::min(share, double(max_credits))),
+                      min_credits, max_credits);
+}
+
+// Report the session's throughput, and once every expected session has
+// closed, the aggregate throughput from the first open to the last close.
+session_summary rpc_server::close_session(uint64_t id) {
+    std::unique_lock<std::shared_mutex> guard(_mutex);
+    auto it = _sessions.find(id);
+    if (it == _sessions.end()) {
+        throw std::out_of_range("unknown session");
+    }
+    std::shared_ptr<game_session> sess = std::move(it->second);
+    _sessions.erase(it);
+    --_nsessions;
+
+    // no new batch can enter the session now; wait for running ones
+    guard.unlock();
+    sess->wait_idle();
+    guard.lock();
+
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - sess->opened;
+    std::cout << std::format("session {}: {} tries in {:.3f} sec, {:.0f} tries/sec\n",
+                             id, sess->count(), elapsed.count(),
+                             sess->count() / elapsed.count());
+    _total_count += sess->count();
+    ++_closed;
+    bool last = _closed == _expected;
+    if (last && _expected > 1) {
+        elapsed = now - _first_opened;
+        std::cout << std::format("{} sessions: {} tries in {:.3f} sec, {:.0f} tries/sec\n",
+                                 _closed, _total_count, elapsed.count(),
+                                 _total_count / elapsed.count());
+    }
+    return {sess->checksum(game_session::client_type),
+            sess->checksum(game_session::server_type),
+            last};
 }
 
 rpc_server rpcc;
@@ -82,17 +493,42 @@ rpc_server rpcc;
 
 // connectors required by `serverstub.cc`
 
-uint64_t server_process_try(uint64_t serial, const char* name, size_t name_len,
-                            uint64_t value) {
-    return rpcc.process_try(serial, name, name_len, value);
+uint64_t server_open_session() {
+    return rpcc.open_session();
+}
+
+size_t server_expected_sessions() {
+    return rpcc.expected_sessions();
+}
+
+void server_set_single_threaded() {
+    rpcc.set_single_threaded();
+}
+
+uint64_t server_process_try(uint64_t session, uint64_t serial,
+                            const char* name, size_t name_len, uint64_t count) {
+    prepared_try t = prepare_try(name, name_len, count);
+    uint64_t response;
+    rpcc.process_batch(session, serial, &t, 1, &response);
+    return response;
 }
 
-std::string client_checksum() {
-    return rpcc.checksum(rpc_server::client_type);
+void server_process_batch(uint64_t session, uint64_t serial_base,
+                          const prepared_try* tries, size_t n,
+                          uint64_t* values) {
+    rpcc.process_batch(session, serial_base, tries, n, values);
 }
 
-std::string server_checksum() {
-    return rpcc.checksum(rpc_server::server_type);
+uint32_t server_credits() {
+    return rpcc.credits();
+}
+
+bool server_resume_session(uint64_t session, uint64_t serial) {
+    return rpcc.find_session(session)->resume(serial);
+}
+
+session_summary server_close_session(uint64_t session) {
+    return rpcc.close_session(session);
 }
 
 
@@ -101,18 +537,59 @@ std::string server_checksum() {
 int main(int argc, char* const argv[]) {
     bool all = false;
     int port = 29381;
+    std::string shm_name;
+    bool udp = false;
+    bool perf = false;
+    size_t nclients = 1;
+    size_t nthreads = 0;
+    static const option long_options[] = {
+        {"perf", no_argument, nullptr, 'P'},
+        {nullptr, 0, nullptr, 0}
+    };
     int ch;
-    while ((ch = getopt(argc, argv, "ap:")) != -1) {
+    while ((ch = getopt_long(argc, argv, "ap:j:s:c:u", long_options, nullptr)) != -1) {
         if (ch == 'p') {
             port = from_str_chars<uint16_t>(std::string(optarg));
         } else if (ch == 'a') {
             all = true;
+        } else if (ch == 'j') {
+            nthreads = std::max(from_str_chars<size_t>(std::string(optarg)), size_t(1));
+        } else if (ch == 's') {
+            shm_name = optarg;
+        } else if (ch == 'u') {
+            udp = true;
+        } else if (ch == 'c') {
+            nclients = std::max(from_str_chars<size_t>(std::string(optarg)), size_t(1));
+        } else if (ch == 'P') {
+            perf = true;
         }
     }
+    rpcc.expect_sessions(nclients);
 
-    if (all) {
-        server_start(std::format("0.0.0.0:{}", port));
+    std::string address;
+    if (!shm_name.empty()) {
+        // serve one same-host client over shared memory ("shm:/name")
+        if (nclients != 1) {
+            std::cerr << "warning: shared memory serves one client\n";
+            rpcc.expect_sessions(1);
+        }
+        address = std::format("shm:{}", shm_name);
+        nthreads = 1;
+    } else if (udp) {
+        // serve clients over UDP datagrams on `port` ("udp:host:port")
+        address = std::format("udp:{}:{}", all ? "0.0.0.0" : "localhost", port);
+        nthreads = 1;
     } else {
-        server_start(std::format("localhost:{}", port));
+        address = std::format("{}:{}", all ? "0.0.0.0" : "localhost", port);
+    }
+
+    perf_counters counters;
+    if (perf) {
+        counters.start();
+    }
+    server_start(address, nthreads);
+    if (perf) {
+        counters.stop();
+        counters.report(std::cout, rpcc.total_count());
     }
 }
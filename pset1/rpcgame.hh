@@ -3,46 +3,133 @@
 #include <charconv>
 #include <bit>
 #include <cstdint>
+#include <cstring>
 #include <format>
+#include <memory>
 #include <string>
 #include "xxhash.h"
 
+// Client options, chosen by `client.cc` and passed to `client_connect`
+enum class batch_encoding {
+    plain,      // every try carries its name
+    dict,       // repeated names are sent as per-session dictionary IDs
+    columnar    // serial base plus count, name-length, and name columns
+};
+
+struct client_options {
+    batch_encoding encoding = batch_encoding::dict;
+    size_t window = 0;          // max in-flight tries; 0 means adaptive
+    size_t batch = 0;           // tries per batch; 0 means adaptive
+    size_t connections = 1;     // number of connections to spread batches over
+    std::string latency_csv;    // if nonempty, write latency histograms here
+};
+
 // Implemented in `clientstub.cc`, called by `client.cc`:
 // - open a connection
-void client_connect(std::string address);
+void client_connect(std::string address, const client_options& options = {});
 
-// - send a pair to the server
+// - send a pair to the server. `name` is not copied, so it must remain valid
+//   until `client_finish` returns
 void client_send_try(const char* name, size_t name_len, uint64_t count);
 
-// - send a finish message to the server and wait for the response
+// - send a finish message to the server and wait for the response. Any
+//   transport threads have exited when this returns
 void client_finish();
 
 
 // Implemented in `serverstub.cc`, called by `server.cc`:
-// - start the server listening on `address`; does not return
-void server_start(std::string address);
+// - start the server listening on `address` with `nthreads` worker threads
+//   (0 picks the transport's default); returns after every expected client
+//   session finishes. Once clients can connect, it prints and flushes a
+//   line starting "Server listening on", which `rpcg-bench` waits for.
+void server_start(std::string address, size_t nthreads = 0);
 
 
 // Implemented in `client.cc`:
 // - account for a received response
 void client_recv_try_response(uint64_t value);
 
+// - return the checksum of client requests
+std::string client_checksum();
+
+// - return the checksum of server responses
+std::string server_checksum();
+
 
 // Implemented in `server.cc`:
-// - process a pair sent by the client
-uint64_t server_process_try(uint64_t serial, const char* name, size_t name_len,
-                            uint64_t count);
+// - open a session: an independent serial space (starting at 1), count,
+//   and pair of checksums. Every client runs in its own session, so many
+//   clients can drive one server. Returns the session ID.
+uint64_t server_open_session();
+
+// - return the number of clients the server was started for (`-c`)
+size_t server_expected_sessions();
+
+// - declare that the transport makes every session call from one thread
+//   and sends each session's batches in serial order, so batches commit
+//   without locks or the sequencer. Call before opening any session.
+void server_set_single_threaded();
+
+// - process a pair sent by the client of session `session`
+uint64_t server_process_try(uint64_t session, uint64_t serial,
+                            const char* name, size_t name_len, uint64_t count);
+
+// - process `n` prepared pairs with consecutive serials starting at
+//   `serial_base`, storing their responses in `values`. Stubs prepare a
+//   batch (see `prepare_try`) before it is the batch's turn, so name
+//   hashing runs in parallel and only the commit is serialized.
+struct prepared_try {
+    const char* name;
+    size_t name_len;
+    uint64_t count;
+    uint64_t name_hash;     // XXH3_64bits(name, name_len)
+};
+void server_process_batch(uint64_t session, uint64_t serial_base,
+                          const prepared_try* tries, size_t n,
+                          uint64_t* values);
+
+// - return true if session `session` can resume a client whose first
+//   unacknowledged serial is `serial`. Re-sent tries that were already
+//   committed are answered from the session's replay buffer, which holds
+//   the last `replay_capacity` responses, rather than processed again.
+//   Batches still waiting for their turn fail, since the client re-sends
+//   them, so a resumed session never holds a worker per copy.
+bool server_resume_session(uint64_t session, uint64_t serial);
+
+// - return how many tries a client may have in flight. Stubs return this
+//   with every batch response, and clients never exceed the latest grant,
+//   so a slow server bounds its queue instead of letting work pile up.
+uint32_t server_credits();
+
+// - close session `session` and return its checksums. `last` is true if
+//   every session the server expects has now closed, so it should exit.
+struct session_summary {
+    std::string client_checksum;
+    std::string server_checksum;
+    bool last;
+};
+session_summary server_close_session(uint64_t session);
 
 // - account for termination
 void server_done();
 
 
-// Implemented in both `client.cc` and `server.cc`:
-// - return the checksum of client requests
-std::string client_checksum();
+// Wire protocol constants
+// - maximum number of names in a session's name dictionary
+constexpr uint32_t name_dictionary_capacity = 1U << 24;
 
-// - return the checksum of server responses
-std::string server_checksum();
+// - maximum number of batches a client has in flight. A server worker
+//   blocks until its batch's turn, so a server with more worker threads
+//   than this per client always has one free to read the batch everyone
+//   waits for, even when batches arrive out of order over several
+//   connections. The rpclib server refuses fewer threads, and clients
+//   beyond the number it was started for.
+constexpr size_t max_batches_in_flight = 16;
+
+// - number of recent responses a session keeps for re-sent batches. A
+//   client that loses its connection can resume only if all its
+//   unacknowledged tries fit.
+constexpr size_t replay_capacity = 1 << 18;
 
 
 // Helper functions
@@ -54,6 +141,68 @@ inline void XXH3_64bits_update_uint64(XXH3_state_t* ctx, uint64_t value) {
     XXH3_64bits_update(ctx, &value, sizeof(value));
 }
 
+// - append `value` to `buf` as a LEB128 varint
+inline void put_varint(std::string& buf, uint64_t value) {
+    while (value >= 0x80) {
+        buf.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    buf.push_back(char(value));
+}
+
+// - parse a LEB128 varint from `[s, end)` into `value` and advance `s`;
+//   return false on truncated or overlong input
+inline bool get_varint(const char*& s, const char* end, uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; s != end && shift < 64; shift += 7) {
+        unsigned char ch = *s;
+        ++s;
+        value |= uint64_t(ch & 0x7F) << shift;
+        if (ch < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// - store and load little-endian integers
+inline void store_le32(char* s, uint32_t value) {
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    memcpy(s, &value, sizeof(value));
+}
+
+inline uint32_t load_le32(const char* s) {
+    uint32_t value;
+    memcpy(&value, s, sizeof(value));
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+inline void store_le64(char* s, uint64_t value) {
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    memcpy(s, &value, sizeof(value));
+}
+
+inline uint64_t load_le64(const char* s) {
+    uint64_t value;
+    memcpy(&value, s, sizeof(value));
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+// - fill in a `prepared_try`, hashing its name
+inline prepared_try prepare_try(const char* name, size_t name_len, uint64_t count) {
+    return {name, name_len, count, XXH3_64bits(name, name_len)};
+}
+
 // - return an XX3 hash as a hex string
 inline std::string XXH3_64bits_hexdigest(XXH3_state_t* ctx) {
     uint64_t digest = XXH3_64bits_digest(ctx);
@@ -88,4 +237,60 @@ inline T from_str_chars(const std::string& s, int base = 10) {
     class_name& operator=(const class_name&) = delete; \
     class_name& operator=(class_name&&) = delete
 
+
+// checksum_accumulator
+//    An XXH3 stream that stages input in a 64 KiB buffer and hashes it in
+//    large chunks, rather than paying `XXH3_64bits_update`'s per-call cost
+//    for every name and value. XXH3 streaming does not depend on how input
+//    is split, so digests equal those of the unbuffered updates.
+
+class checksum_accumulator {
+public:
+    checksum_accumulator()
+        : _ctx(XXH3_createState()), _buf(new char[capacity]) {
+        XXH3_64bits_reset(_ctx);
+    }
+    ~checksum_accumulator() {
+        XXH3_freeState(_ctx);
+    }
+
+    inline void append(const char* s, size_t n) {
+        if (n > capacity - _len) {
+            flush();
+            if (n >= capacity) {
+                XXH3_64bits_update(_ctx, s, n);
+                return;
+            }
+        }
+        memcpy(_buf.get() + _len, s, n);
+        _len += n;
+    }
+    // - append `value` in little-endian order
+    inline void append_uint64(uint64_t value) {
+        if (sizeof(value) > capacity - _len) {
+            flush();
+        }
+        store_le64(_buf.get() + _len, value);
+        _len += sizeof(value);
+    }
+
+    std::string hexdigest() {
+        flush();
+        return XXH3_64bits_hexdigest(_ctx);
+    }
+
+private:
+    static constexpr size_t capacity = 65536;
+    XXH3_state_t* _ctx;
+    size_t _len = 0;
+    std::unique_ptr<char[]> _buf;
+
+    void flush() {
+        XXH3_64bits_update(_ctx, _buf.get(), _len);
+        _len = 0;
+    }
+
+    NONCOPYABLE(checksum_accumulator);
+};
+
 #endif
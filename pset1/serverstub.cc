@@ -1,55 +1,399 @@
 #include <rpc/server.h>
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <tuple>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
-#include "rpcgame.hh"
+#include "columnar.hh"
+#include "shmring.hh"
+#include "udpdgram.hh"
 
 static std::unique_ptr<rpc::server> server;
+static std::promise<void> server_stopped;
+
+
+// Mirror of a client's name dictionary. Each ID is defined by a try that
+// carries the name; the client uses the ID only after that try's response
+// arrives, so lookups need no lock. A re-sent batch may define an ID again,
+// even concurrently with the original; only the first definition writes.
+class name_table {
+public:
+    name_table() = default;
+    ~name_table();
+
+    void define(uint64_t id, const char* name, size_t name_len);
+    const std::string& find(uint64_t id) const;
+
+private:
+    static constexpr unsigned chunk_bits = 12;
+    static constexpr size_t chunk_size = size_t(1) << chunk_bits;
+    static constexpr size_t nchunks = name_dictionary_capacity / chunk_size;
+
+    enum state : uint8_t {
+        undefined, defining, defined
+    };
+    struct entry {
+        std::string name;
+        std::atomic<state> st = undefined;
+    };
+    using chunk = std::array<entry, chunk_size>;
+    std::atomic<chunk*> _chunks[nchunks] = {};
+
+    NONCOPYABLE(name_table);
+};
+
+name_table::~name_table() {
+    for (auto& c : _chunks) {
+        delete c.load(std::memory_order_relaxed);
+    }
+}
+
+void name_table::define(uint64_t id, const char* name, size_t name_len) {
+    if (id >= name_dictionary_capacity) {
+        throw std::out_of_range("name ID out of range");
+    }
+    auto& slot = _chunks[id >> chunk_bits];
+    chunk* c = slot.load(std::memory_order_acquire);
+    if (!c) {
+        // batches are processed concurrently, so another thread may
+        // install this chunk first
+        auto fresh = std::make_unique<chunk>();
+        if (slot.compare_exchange_strong(c, fresh.get(), std::memory_order_acq_rel)) {
+            c = fresh.release();
+        }
+    }
+    entry& e = (*c)[id & (chunk_size - 1)];
+    state st = undefined;
+    if (e.st.compare_exchange_strong(st, defining, std::memory_order_acquire)) {
+        e.name.assign(name, name_len);
+        e.st.store(defined, std::memory_order_release);
+    } else {
+        // our batch's response must not overtake the definition
+        while (e.st.load(std::memory_order_acquire) != defined) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+const std::string& name_table::find(uint64_t id) const {
+    if (id < name_dictionary_capacity) {
+        if (chunk* c = _chunks[id >> chunk_bits].load(std::memory_order_acquire)) {
+            const entry& e = (*c)[id & (chunk_size - 1)];
+            if (e.st.load(std::memory_order_acquire) == defined) {
+                return e.name;
+            }
+        }
+    }
+    throw std::out_of_range("undefined name ID");
+}
+
+
+// Per-client transport state, created by `open_session`. A session's ID
+// also names its game session in `server.cc`, which holds the serial
+// space and checksums; all of a client's connections share both. The
+// random `token` authorizes a reconnecting client to resume the session.
+// A call holds its session, whose name table its tries may point into,
+// until it returns, even if `done` closes the session meanwhile.
+struct session {
+    name_table names;
+    uint64_t token;
+};
+
+static std::mutex sessions_mutex;
+static std::unordered_map<uint64_t, std::shared_ptr<session>> sessions;
+static std::mt19937_64 token_generator{std::random_device{}()};
+static size_t nopened = 0;
+
+// A closed session's checksums. `done` returns them again to a client that
+// lost the first response and reconnected, and the client's `goodbye`
+// confirms receipt. The server stops once every expected session has
+// said goodbye, or `done_linger` after the last `done` if one never does.
+struct closed_session {
+    uint64_t token;
+    std::tuple<std::string, std::string> checksums;
+    bool acknowledged = false;
+};
+
+static constexpr auto done_linger = std::chrono::seconds(30);
+static std::mutex done_mutex;           // a retried `done` waits for the original
+static std::unordered_map<uint64_t, closed_session> closed_sessions;
+static bool all_closed = false;
+static size_t nacknowledged = 0;
+static std::atomic<bool> stopping = false;
+
+static std::tuple<uint64_t, uint64_t, uint32_t> open_session() {
+    {
+        // the worker pool is sized for the expected clients
+        std::lock_guard<std::mutex> guard(sessions_mutex);
+        if (nopened == server_expected_sessions()) {
+            throw std::length_error(std::format("server expects {} clients",
+                                                nopened));
+        }
+        ++nopened;
+    }
+    uint64_t id = server_open_session();
+    std::lock_guard<std::mutex> guard(sessions_mutex);
+    auto& sess = sessions[id];
+    sess = std::make_shared<session>();
+    sess->token = token_generator();
+    return {id, sess->token, server_credits()};
+}
+
+static session_summary close_session(uint64_t id) {
+    {
+        std::lock_guard<std::mutex> guard(sessions_mutex);
+        sessions.erase(id);
+    }
+    return server_close_session(id);
+}
+
+static std::shared_ptr<session> find_session(uint64_t id) {
+    std::lock_guard<std::mutex> guard(sessions_mutex);
+    auto it = sessions.find(id);
+    if (it == sessions.end()) {
+        throw std::out_of_range("unknown session");
+    }
+    return it->second;
+}
+
+// Resume a session after a reconnect. The client will re-send every try
+// from `serial` on, so the session must still be able to answer them.
+static bool resume_session(uint64_t id, uint64_t token, uint64_t serial) {
+    if (find_session(id)->token != token) {
+        throw std::invalid_argument("bad session token");
+    }
+    return server_resume_session(id, serial);
+}
+
+// - stop the server after `delay`, unless it is already stopping
+static void stop_server_after(std::chrono::milliseconds delay) {
+    std::thread([delay] {
+        std::this_thread::sleep_for(delay);
+        if (!stopping.exchange(true)) {
+            server->stop();
+            server_stopped.set_value();
+        }
+    }).detach();
+}
+
+// Close the session and return its (client, server) checksums. Idempotent.
+static std::tuple<std::string, std::string> done(uint64_t id, uint64_t token) {
+    std::lock_guard<std::mutex> done_guard(done_mutex);
+    {
+        std::lock_guard<std::mutex> guard(sessions_mutex);
+        auto it = closed_sessions.find(id);
+        if (it != closed_sessions.end()) {
+            if (it->second.token != token) {
+                throw std::invalid_argument("bad session token");
+            }
+            return it->second.checksums;
+        }
+    }
+    if (find_session(id)->token != token) {
+        throw std::invalid_argument("bad session token");
+    }
+    session_summary sum = close_session(id);
+    std::lock_guard<std::mutex> guard(sessions_mutex);
+    auto& closed = closed_sessions[id];
+    closed.token = token;
+    closed.checksums = {std::move(sum.client_checksum),
+                        std::move(sum.server_checksum)};
+    if (sum.last) {
+        all_closed = true;
+        stop_server_after(done_linger);
+    }
+    return closed.checksums;
+}
+
+// The client has its checksums; stop shortly after the last one does
+static void goodbye(uint64_t id, uint64_t token) {
+    std::lock_guard<std::mutex> guard(sessions_mutex);
+    auto it = closed_sessions.find(id);
+    if (it == closed_sessions.end() || it->second.token != token) {
+        throw std::invalid_argument("bad session token");
+    }
+    if (!it->second.acknowledged) {
+        it->second.acknowledged = true;
+        ++nacknowledged;
+    }
+    if (all_closed && nacknowledged == closed_sessions.size()) {
+        stop_server_after(std::chrono::milliseconds(100));
+    }
+}
+
+
+// Unpack a `try_batch` argument in place. The object references rpclib's
+// receive buffer, so names are passed to `server_process_batch` without
+// copying them into `std::string`s.
+//
+// Each item is (serial, name, count). If `sess` is nonnull, items may also
+// be (serial, name, count, id), which defines a dictionary ID, or
+// (serial, id, count), which uses one. Names are hashed during unpacking;
+// each run of consecutive serials is then committed as one batch. The
+// response is (credits, values).
+static std::tuple<uint32_t, std::vector<uint64_t>> process_try_batch(
+        uint64_t session_id,
+        const clmdep_msgpack::object& items, session* sess) {
+    using clmdep_msgpack::type::ARRAY;
+    using clmdep_msgpack::type::POSITIVE_INTEGER;
+    using clmdep_msgpack::type::STR;
+    if (items.type != ARRAY) {
+        throw clmdep_msgpack::type_error();
+    }
+    thread_local std::vector<prepared_try> tries;
+    thread_local std::vector<uint64_t> serials;
+    tries.clear();
+    serials.clear();
+    const clmdep_msgpack::object* it = items.via.array.ptr;
+    const clmdep_msgpack::object* end = it + items.via.array.size;
+    for (; it != end; ++it) {
+        if (it->type != ARRAY
+            || it->via.array.size < 3
+            || it->via.array.size > (sess ? 4 : 3)) {
+            throw clmdep_msgpack::type_error();
+        }
+        const clmdep_msgpack::object* f = it->via.array.ptr;
+        if (f[0].type != POSITIVE_INTEGER
+            || f[2].type != POSITIVE_INTEGER
+            || (it->via.array.size == 4 && f[3].type != POSITIVE_INTEGER)) {
+            throw clmdep_msgpack::type_error();
+        }
+        const char* name;
+        size_t name_len;
+        if (f[1].type == STR) {
+            name = f[1].via.str.ptr;
+            name_len = f[1].via.str.size;
+            if (it->via.array.size == 4) {
+                sess->names.define(f[3].via.u64, name, name_len);
+            }
+        } else if (f[1].type == POSITIVE_INTEGER && sess) {
+            const std::string& s = sess->names.find(f[1].via.u64);
+            name = s.data();
+            name_len = s.size();
+        } else {
+            throw clmdep_msgpack::type_error();
+        }
+        serials.push_back(f[0].via.u64);
+        tries.push_back(prepare_try(name, name_len, f[2].via.u64));
+    }
+
+    std::vector<uint64_t> out(tries.size());
+    for (size_t i = 0; i != tries.size(); ) {
+        size_t j = i + 1;
+        while (j != tries.size() && serials[j] == serials[i] + (j - i)) {
+            ++j;
+        }
+        server_process_batch(session_id, serials[i], &tries[i], j - i, &out[i]);
+        i = j;
+    }
+    return {server_credits(), std::move(out)};
+}
+
+// Process a columnar batch (see `columnar.hh`). The columns reference
+// rpclib's receive buffer; the response is (credits, one binary blob).
+static std::tuple<uint32_t, std::vector<char>> process_try_batch_columnar(
+        uint64_t session_id, uint64_t serial_base, uint32_t n,
+        clmdep_msgpack::type::raw_ref counts,
+        clmdep_msgpack::type::raw_ref name_lens,
+        clmdep_msgpack::type::raw_ref names) {
+    check_columnar_size(n, counts.size, name_lens.size);
+    std::vector<char> out(size_t(n) * sizeof(uint64_t));
+    process_columnar_batch(session_id, serial_base, n,
+                           {counts.ptr, counts.size},
+                           {name_lens.ptr, name_lens.size},
+                           {names.ptr, names.size},
+                           out.data());
+    return {server_credits(), std::move(out)};
+}
+
+
+void server_start(std::string address, size_t nthreads) {
+    // "shm:/name" selects the shared-memory transport, which is served by
+    // this thread alone
+    if (is_shm_address(address)) {
+        shm_server_start(std::move(address));
+        return;
+    }
+    // "udp:host:port" selects the datagram transport, also single-threaded
+    if (is_udp_address(address)) {
+        udp_server_start(std::move(address));
+        return;
+    }
+
+    // Handlers answer synchronously, so a batch that arrives before its
+    // turn holds a worker until then. With too few workers, every one can
+    // wait on a batch that none is free to read.
+    size_t nclients = server_expected_sessions();
+    if (nthreads == 0) {
+        nthreads = std::max(size_t(std::thread::hardware_concurrency()),
+                            max_batches_in_flight * nclients + 1);
+    }
+    if (nthreads <= max_batches_in_flight * nclients) {
+        std::cerr << "-j: " << nclients << " clients need at least "
+                  << max_batches_in_flight * nclients + 1 << " threads\n";
+        std::exit(1);
+    }
 
-void server_start(std::string address) {
     size_t colon = address.find(':');
     int port = std::stoi(address.substr(colon + 1));
 
     server = std::make_unique<rpc::server>(port);
+    // report malformed batches to the client instead of crashing
+    server->suppress_exceptions(true);
+
+    // Every client first opens a session, receiving (id, token, credits);
+    // the other calls name it. A client that reconnects resumes it with
+    // (id, token, first unacknowledged serial) and then re-sends.
+    server->bind("open_session", &open_session);
+    server->bind("resume_session", &resume_session);
 
     // Single-try (optional: keep for debugging; client can stop using it)
-    server->bind("try", [](uint64_t serial, const std::string& name, uint64_t count) -> uint64_t {
-        return server_process_try(serial, name.data(), name.size(), count);
+    server->bind("try", [](uint64_t session_id, uint64_t serial,
+                           const std::string& name, uint64_t count) -> uint64_t {
+        return server_process_try(session_id, serial, name.data(), name.size(), count);
     });
 
-    // Batched try: list of (serial, name, count) -> list of values
-    server->bind("try_batch",
-                 [](const std::vector<std::tuple<uint64_t, std::string, uint64_t>>& items)
-                     -> std::vector<uint64_t> {
-                     std::vector<uint64_t> out;
-                     out.reserve(items.size());
-                     for (const auto& it : items) {
-                         uint64_t serial = std::get<0>(it);
-                         const std::string& name = std::get<1>(it);
-                         uint64_t count = std::get<2>(it);
-                         out.push_back(server_process_try(serial, name.data(), name.size(), count));
-                     }
-                     return out;
-                 });
-
-    server->bind("done", [&]() -> std::tuple<std::string, std::string> {
-        auto out = std::make_tuple(client_checksum(), server_checksum());
-        std::thread([&]{
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            server->stop();
-        }).detach();
-        return out;
+    // Batched try: list of (serial, name, count) -> (credits, list of values)
+    server->bind("try_batch", [](uint64_t session_id,
+                                 const clmdep_msgpack::object& items) {
+        return process_try_batch(session_id, items, nullptr);
+    });
+
+    // Batched try using the session's name dictionary
+    server->bind("try_batch_dict", [](uint64_t session_id,
+                                      const clmdep_msgpack::object& items) {
+        std::shared_ptr<session> sess = find_session(session_id);
+        return process_try_batch(session_id, items, sess.get());
     });
 
-    std::cout << "Server listening on " << address << "\n";
-    server->run();
+    // Columnar batch: (session, serial_base, n, counts, name_lens, names)
+    // -> (credits, values)
+    server->bind("try_batch_columnar", &process_try_batch_columnar);
+
+    // Close the session with (id, token) -> (client, server checksums);
+    // the client then says goodbye, and the server stops after its last
+    // expected client does
+    server->bind("done", &done);
+    server->bind("goodbye", &goodbye);
+
+    // `try` handlers run concurrently on all worker threads;
+    // `server_process_try` puts them back in serial order
+    std::cout << "Server listening on " << address << " with "
+              << nthreads << " threads\n" << std::flush;
+    server->async_run(nthreads);
+    server_stopped.get_future().wait();
     std::cout << "Server exiting\n";
 }
@@ -0,0 +1,195 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "batching.hh"
+#include "shmring.hh"
+
+// rpcgame client over a shared-memory segment created by the server.
+//
+// `send_try` copies each try into the request ring and publishes the ring
+// head once per `publish_bytes`, draining responses at the same time. It
+// blocks only when the request ring is full.
+
+namespace {
+
+class shm_client {
+public:
+    explicit shm_client(const std::string& name);
+    ~shm_client();
+
+    inline void send_try(const char* name, size_t name_len, uint64_t count);
+    void finish();
+
+private:
+    static constexpr size_t publish_bytes = 4096;
+
+    shm_segment* _seg;
+    shm_writer _requests;
+    shm_reader _responses;
+
+    char* reserve(size_t n);
+    void flush();
+    bool drain_responses();
+
+    NONCOPYABLE(shm_client);
+};
+
+// The segment's name appears before the server sizes and constructs it,
+// so wait, briefly, for its size and then its `magic`
+shm_segment* map_segment(const std::string& name) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    auto wait_or_fail = [&] {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            std::cerr << "client_connect: shm:" << name << ": segment not ready\n";
+            std::exit(1);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    };
+
+    int fd;
+    while ((fd = shm_open(name.c_str(), O_RDWR, 0)) < 0 && errno == ENOENT) {
+        wait_or_fail();
+    }
+    struct stat st;
+    while (fd >= 0 && fstat(fd, &st) == 0
+           && size_t(st.st_size) < sizeof(shm_segment)) {
+        wait_or_fail();
+    }
+    if (fd < 0 || size_t(st.st_size) < sizeof(shm_segment)) {
+        std::cerr << "client_connect: shm:" << name << ": " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+    void* p = mmap(nullptr, sizeof(shm_segment), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "client_connect: mmap: " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+    auto seg = reinterpret_cast<shm_segment*>(p);
+    while (seg->magic.load(std::memory_order_acquire) != shm_segment::magic_value) {
+        wait_or_fail();
+    }
+    if (seg->attached.exchange(1) != 0) {
+        std::cerr << "client_connect: shm:" << name << ": segment in use\n";
+        std::exit(1);
+    }
+    return seg;
+}
+
+shm_client::shm_client(const std::string& name)
+    : _seg(map_segment(name)),
+      _requests(_seg->requests, _seg->request_data, shm_segment::request_capacity),
+      _responses(_seg->responses, _seg->response_data, shm_segment::response_capacity) {
+}
+
+shm_client::~shm_client() {
+    munmap(_seg, sizeof(shm_segment));
+}
+
+// Publish pending requests and consumed responses, waking the server if
+// it sleeps
+void shm_client::flush() {
+    bool progress = _requests.publish();
+    progress = _responses.release() || progress;
+    if (progress) {
+        _seg->server_bell.ring();
+    }
+}
+
+// Deliver every available response. Returns true if there were any.
+bool shm_client::drain_responses() {
+    size_t avail;
+    const char* p = _responses.peek(avail);
+    if (avail == 0) {
+        return false;
+    }
+    for (size_t i = 0; i != avail; i += sizeof(uint64_t)) {
+        uint64_t value;
+        memcpy(&value, p + i, sizeof(value));
+        client_recv_try_response(value);
+    }
+    _responses.consume(avail);
+    return true;
+}
+
+char* shm_client::reserve(size_t n) {
+    if (n > shm_segment::request_capacity) {
+        std::cerr << "client: try too large for shared-memory ring\n";
+        std::exit(1);
+    }
+    char* p;
+    while (!(p = _requests.reserve(n))) {
+        flush();
+        if (!drain_responses()) {
+            _seg->client_bell.wait([&] {
+                return _requests.consumer_moved() || _responses.producer_moved();
+            });
+        }
+    }
+    return p;
+}
+
+inline void shm_client::send_try(const char* name, size_t name_len,
+                                 uint64_t count) {
+    size_t n = shm_request_size(name_len);
+    char* p = reserve(n);
+    uint32_t len32 = name_len;
+    memcpy(p, &len32, sizeof(len32));
+    memcpy(p + 8, &count, sizeof(count));
+    memcpy(p + shm_request_header_size, name, name_len);
+    _requests.commit(n);
+    if (_requests.unpublished() >= publish_bytes) {
+        drain_responses();
+        flush();
+    }
+}
+
+void shm_client::finish() {
+    char* p = reserve(shm_request_header_size);
+    memcpy(p, &shm_done_marker, sizeof(shm_done_marker));
+    _requests.commit(shm_request_header_size);
+    flush();
+
+    // the server sets `done` after publishing its last response
+    while (true) {
+        bool done = _seg->done.load(std::memory_order_acquire);
+        while (drain_responses()) {
+            flush();
+        }
+        if (done) {
+            break;
+        }
+        _seg->client_bell.wait([&] {
+            return _seg->done.load() != 0 || _responses.producer_moved();
+        });
+    }
+
+    report_checksums(_seg->checksums[0], _seg->checksums[1]);
+}
+
+std::unique_ptr<shm_client> client;
+
+}
+
+
+void shm_client_connect(std::string address) {
+    client = std::make_unique<shm_client>(address.substr(strlen(shm_address_prefix)));
+}
+
+void shm_client_send_try(const char* name, size_t name_len, uint64_t count) {
+    client->send_try(name, name_len, count);
+}
+
+void shm_client_finish() {
+    client->finish();
+}
@@ -0,0 +1,271 @@
+#ifndef CS2620_PSET1_SHMRING_HH
+#define CS2620_PSET1_SHMRING_HH
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#if defined(__linux__)
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+#include "rpcgame.hh"
+
+// Shared-memory transport for client and server on the same host, selected
+// by addresses of the form "shm:/name". The server creates the POSIX shared
+// memory object `/name` holding two single-producer, single-consumer rings:
+// requests from client to server and responses back. One client may use a
+// segment at a time.
+//
+// A request record is a 16-byte header (name length, padding, count)
+// followed by the name, padded to 8 bytes; serials are implicit. A response
+// is one 8-byte value. Records never straddle the end of a ring: a writer
+// that reaches the end writes `shm_wrap_marker` there and starts over.
+
+constexpr char shm_address_prefix[] = "shm:";
+
+inline bool is_shm_address(const std::string& address) {
+    return address.starts_with(shm_address_prefix);
+}
+
+constexpr uint32_t shm_wrap_marker = 0xFFFFFFFFU;
+constexpr uint32_t shm_done_marker = 0xFFFFFFFEU;
+constexpr size_t shm_request_header_size = 16;
+
+inline size_t shm_request_size(size_t name_len) {
+    return shm_request_header_size + ((name_len + 7) & ~size_t(7));
+}
+
+
+// shm_doorbell
+//    A futex word one side sleeps on. The sleeper announces itself in
+//    `sleeping` before rechecking its condition, and the other side rings
+//    only if it sees the announcement, so the common case costs one load.
+
+struct shm_doorbell {
+    std::atomic<uint32_t> epoch = 0;
+    std::atomic<uint32_t> sleeping = 0;
+
+    template <typename F> inline void wait(F ready);
+    inline void ring();
+};
+
+template <typename F>
+inline void shm_doorbell::wait(F ready) {
+    for (int spin = 0; spin != 1024; ++spin) {
+        if (ready()) {
+            return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+    while (true) {
+        uint32_t e = epoch.load();
+        // `sleeping` and the rings' positions are sequentially consistent,
+        // so either `ring` sees us or `ready` sees the ringer's update
+        sleeping.store(1);
+        if (ready()) {
+            sleeping.store(0);
+            return;
+        }
+#if defined(__linux__)
+        // not FUTEX_PRIVATE_FLAG: the word is shared between processes
+        syscall(SYS_futex, &epoch, FUTEX_WAIT, e, nullptr, nullptr, 0);
+#else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+        sleeping.store(0);
+    }
+}
+
+inline void shm_doorbell::ring() {
+    if (sleeping.load() != 0) {
+        epoch.fetch_add(1);
+#if defined(__linux__)
+        syscall(SYS_futex, &epoch, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#endif
+    }
+}
+
+
+// shm_ring
+//    Byte positions of one ring; `head` counts bytes produced and `tail`
+//    bytes consumed. They live on separate cache lines.
+
+struct shm_ring {
+    alignas(64) std::atomic<uint64_t> head = 0;
+    alignas(64) std::atomic<uint64_t> tail = 0;
+};
+
+
+// shm_segment
+//    Layout of the shared memory object. The server stores `magic` last,
+//    with release ordering, once the segment is sized and constructed.
+
+struct shm_segment {
+    static constexpr uint64_t magic_value = 0x316D687367637072;   // "rpcgshm1"
+    static constexpr size_t request_capacity = size_t(1) << 22;
+    static constexpr size_t response_capacity = size_t(1) << 20;
+
+    std::atomic<uint64_t> magic = 0;        // `magic_value` once ready
+    std::atomic<uint32_t> attached = 0;     // a client has connected
+    std::atomic<uint32_t> done = 0;         // server wrote `checksums`
+    char checksums[2][32] = {};             // client, server checksums
+
+    alignas(64) shm_doorbell client_bell;   // client sleeps here
+    alignas(64) shm_doorbell server_bell;   // server sleeps here
+    shm_ring requests;
+    shm_ring responses;
+    alignas(64) char request_data[request_capacity];
+    alignas(64) char response_data[response_capacity];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free
+              && std::atomic<uint32_t>::is_always_lock_free);
+
+
+// shm_writer, shm_reader
+//    Process-local ends of a ring. Each caches the other side's position
+//    and publishes its own only on `publish`/`release`, so a run of records
+//    costs one shared store.
+
+class shm_writer {
+public:
+    shm_writer(shm_ring& ring, char* data, size_t capacity)
+        : _ring(ring), _data(data), _capacity(capacity) {
+    }
+
+    // Return space for an `n`-byte record, or nullptr if the ring is full
+    inline char* reserve(size_t n);
+    // Return contiguous space for up to `count` `n`-byte records, setting
+    // `count` to the number that fit, or nullptr if none fit. Never wraps
+    // when `n` divides the capacity.
+    inline char* reserve_run(size_t n, size_t& count);
+    void commit(size_t n) {
+        _head += n;
+    }
+    // Make committed records visible; return true if there were any
+    inline bool publish();
+    size_t unpublished() const {
+        return _head - _published;
+    }
+    bool consumer_moved() const {
+        return _ring.tail.load() != _tail_cache;
+    }
+
+private:
+    shm_ring& _ring;
+    char* _data;
+    size_t _capacity;
+    uint64_t _head = 0;
+    uint64_t _published = 0;
+    uint64_t _tail_cache = 0;
+};
+
+inline char* shm_writer::reserve(size_t n) {
+    size_t pos = _head % _capacity;
+    size_t skip = n > _capacity - pos ? _capacity - pos : 0;
+    if (_head + skip + n - _tail_cache > _capacity) {
+        _tail_cache = _ring.tail.load(std::memory_order_acquire);
+        if (_head + skip + n - _tail_cache > _capacity) {
+            return nullptr;
+        }
+    }
+    if (skip != 0) {
+        memcpy(_data + pos, &shm_wrap_marker, sizeof(shm_wrap_marker));
+        _head += skip;
+        pos = 0;
+    }
+    return _data + pos;
+}
+
+inline char* shm_writer::reserve_run(size_t n, size_t& count) {
+    size_t pos = _head % _capacity;
+    if (_capacity - (_head - _tail_cache) < n * count) {
+        _tail_cache = _ring.tail.load(std::memory_order_acquire);
+    }
+    size_t space = std::min(_capacity - (_head - _tail_cache), _capacity - pos);
+    if (space < n) {
+        count = 1;
+        return reserve(n);
+    }
+    count = std::min(count, space / n);
+    return _data + pos;
+}
+
+inline bool shm_writer::publish() {
+    if (_head == _published) {
+        return false;
+    }
+    _ring.head.store(_head);
+    _published = _head;
+    return true;
+}
+
+
+class shm_reader {
+public:
+    shm_reader(shm_ring& ring, char* data, size_t capacity)
+        : _ring(ring), _data(data), _capacity(capacity) {
+    }
+
+    // Return the contiguous unread bytes and set `avail` to their number
+    inline const char* peek(size_t& avail);
+    void consume(size_t n) {
+        _tail += n;
+    }
+    // Skip the rest of the ring after a wrap marker
+    void consume_to_end() {
+        _tail += _capacity - _tail % _capacity;
+    }
+    // Return consumed space to the writer; return true if there was any
+    inline bool release();
+    size_t unreleased() const {
+        return _tail - _released;
+    }
+    bool producer_moved() const {
+        return _ring.head.load() != _head_cache;
+    }
+
+private:
+    shm_ring& _ring;
+    char* _data;
+    size_t _capacity;
+    uint64_t _tail = 0;
+    uint64_t _released = 0;
+    uint64_t _head_cache = 0;
+};
+
+inline const char* shm_reader::peek(size_t& avail) {
+    if (_tail == _head_cache) {
+        _head_cache = _ring.head.load(std::memory_order_acquire);
+    }
+    size_t pos = _tail % _capacity;
+    avail = std::min(size_t(_head_cache - _tail), _capacity - pos);
+    return _data + pos;
+}
+
+inline bool shm_reader::release() {
+    if (_tail == _released) {
+        return false;
+    }
+    _ring.tail.store(_tail);
+    _released = _tail;
+    return true;
+}
+
+
+// Implemented in `shmclient.cc` and `shmserver.cc`; `client_connect` and
+// `server_start` call these for "shm:" addresses
+void shm_client_connect(std::string address);
+void shm_client_send_try(const char* name, size_t name_len, uint64_t count);
+void shm_client_finish();
+void shm_server_start(std::string address);
+
+#endif
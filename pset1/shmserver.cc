@@ -0,0 +1,136 @@
+#include <sys/mman.h>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "shmring.hh"
+
+// rpcgame server over a shared-memory segment. One thread consumes request
+// records in order, so serials need no reordering, and publishes responses
+// and consumed request space in runs of `publish_bytes`. Each contiguous
+// run of records is committed as one batch, with responses written
+// straight into the response ring.
+
+namespace {
+
+constexpr size_t publish_bytes = 4096;
+constexpr size_t max_run = publish_bytes / sizeof(uint64_t);
+
+shm_segment* create_segment(const std::string& name) {
+    // remove any segment left behind by a server that did not exit cleanly
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        std::cerr << "shm:" << name << ": " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+    if (ftruncate(fd, sizeof(shm_segment)) != 0) {
+        std::cerr << "shm:" << name << ": " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+    void* p = mmap(nullptr, sizeof(shm_segment), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "mmap: " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+    auto seg = new (p) shm_segment;
+    seg->magic.store(shm_segment::magic_value, std::memory_order_release);
+    return seg;
+}
+
+void flush(shm_segment* seg, shm_writer& responses, shm_reader& requests) {
+    bool progress = responses.publish();
+    progress = requests.release() || progress;
+    if (progress) {
+        seg->client_bell.ring();
+    }
+}
+
+}
+
+
+void shm_server_start(std::string address) {
+    std::string name = address.substr(strlen(shm_address_prefix));
+    shm_segment* seg = create_segment(name);
+    shm_reader requests(seg->requests, seg->request_data,
+                        shm_segment::request_capacity);
+    shm_writer responses(seg->responses, seg->response_data,
+                         shm_segment::response_capacity);
+    std::cout << "Server listening on " << address << "\n" << std::flush;
+
+    uint64_t session = server_open_session();
+    uint64_t serial = 1;
+    std::vector<prepared_try> tries;
+    tries.reserve(max_run);
+    while (true) {
+        size_t avail;
+        const char* p = requests.peek(avail);
+        if (avail == 0) {
+            flush(seg, responses, requests);
+            seg->server_bell.wait([&] { return requests.producer_moved(); });
+            continue;
+        }
+
+        uint32_t name_len;
+        memcpy(&name_len, p, sizeof(name_len));
+        if (name_len == shm_wrap_marker) {
+            requests.consume_to_end();
+            continue;
+        } else if (name_len == shm_done_marker) {
+            requests.consume(shm_request_header_size);
+            break;
+        }
+
+        size_t n = max_run;
+        char* out = responses.reserve_run(sizeof(uint64_t), n);
+        if (!out) {
+            flush(seg, responses, requests);
+            seg->server_bell.wait([&] { return responses.consumer_moved(); });
+            continue;
+        }
+
+        // prepare the run's records up to a marker or the reserved space
+        tries.clear();
+        size_t used = 0;
+        while (tries.size() != n && used != avail) {
+            memcpy(&name_len, p + used, sizeof(name_len));
+            if (name_len == shm_wrap_marker || name_len == shm_done_marker) {
+                break;
+            }
+            uint64_t count;
+            memcpy(&count, p + used + 8, sizeof(count));
+            tries.push_back(prepare_try(p + used + shm_request_header_size,
+                                        name_len, count));
+            used += shm_request_size(name_len);
+        }
+        // response positions are 8-byte aligned
+        server_process_batch(session, serial, tries.data(), tries.size(),
+                             reinterpret_cast<uint64_t*>(out));
+        serial += tries.size();
+        responses.commit(tries.size() * sizeof(uint64_t));
+        requests.consume(used);
+
+        if (responses.unpublished() >= publish_bytes
+            || requests.unreleased() >= publish_bytes * 4) {
+            flush(seg, responses, requests);
+        }
+    }
+
+    flush(seg, responses, requests);
+    session_summary sum = server_close_session(session);
+    sum.client_checksum.copy(seg->checksums[0], sizeof(seg->checksums[0]) - 1);
+    sum.server_checksum.copy(seg->checksums[1], sizeof(seg->checksums[1]) - 1);
+    seg->done.store(1);
+    seg->client_bell.ring();
+
+    munmap(seg, sizeof(shm_segment));
+    shm_unlink(name.c_str());
+    std::cout << "Server exiting\n";
+}
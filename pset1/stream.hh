@@ -0,0 +1,142 @@
+#ifndef CS2620_PSET1_STREAM_HH
+#define CS2620_PSET1_STREAM_HH
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+// Pieces shared by the stream transports (cotamer and protobuf), which
+// carry frames over one TCP connection per session.
+
+
+// stream_inbuf
+//    Input buffer for a framed connection. The transports' buffers
+//    (`ct_inbuf`, `pb_inbuf`) add frame parsing.
+
+class stream_inbuf {
+public:
+    // Read what is available from `fd`, blocking only if `fd` is blocking.
+    // Returns the number of bytes read, 0 at EOF, or -1 if a nonblocking
+    // `fd` has nothing; throws on other errors.
+    inline ssize_t fill(int fd);
+
+protected:
+    std::string _buf = std::string(1 << 16, '\0');
+    size_t _head = 0;
+    size_t _tail = 0;
+
+    // - ensure at least 16 KiB are free after `_tail`
+    inline void make_room();
+};
+
+inline void stream_inbuf::make_room() {
+    if (_head == _tail) {
+        _head = _tail = 0;
+    } else if (_head != 0 && _buf.size() - _tail < (1 << 14)) {
+        memmove(_buf.data(), _buf.data() + _head, _tail - _head);
+        _tail -= _head;
+        _head = 0;
+    }
+    if (_buf.size() - _tail < (1 << 14)) {
+        _buf.resize(_buf.size() * 2);
+    }
+}
+
+inline ssize_t stream_inbuf::fill(int fd) {
+    make_room();
+    ssize_t nr = ::read(fd, _buf.data() + _tail, _buf.size() - _tail);
+    if (nr > 0) {
+        _tail += nr;
+    } else if (nr < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return -1;
+    } else if (nr < 0) {
+        throw std::system_error(errno, std::generic_category());
+    }
+    return nr;
+}
+
+
+// - split "host:port" and resolve it; exit on failure
+inline addrinfo* stream_resolve(const std::string& address, bool passive) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << address << ": expected host:port\n";
+        std::exit(1);
+    }
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo* ai;
+    std::string host = address.substr(0, colon);
+    int r = getaddrinfo(host.c_str(), address.c_str() + colon + 1, &hints, &ai);
+    if (r != 0) {
+        std::cerr << address << ": " << gai_strerror(r) << "\n";
+        std::exit(1);
+    }
+    return ai;
+}
+
+// - return a nonblocking TCP_NODELAY socket connected to "host:port"; exit
+//   on failure. (Prefixed so it cannot collide with `cot::tcp_connect`.)
+inline int stream_connect(const std::string& address) {
+    addrinfo* ai = stream_resolve(address, false);
+    int fd = -1, err = 0;
+    for (addrinfo* a = ai; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+        } else if (connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            err = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    if (fd < 0) {
+        std::cerr << address << ": " << strerror(err) << "\n";
+        std::exit(1);
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// - return a socket listening on "host:port"; exit on failure
+inline int stream_listen(const std::string& address) {
+    addrinfo* ai = stream_resolve(address, true);
+    int fd = -1, err = 0;
+    for (addrinfo* a = ai; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) != 0
+            || listen(fd, 128) != 0) {
+            // save the failure before `close` can overwrite `errno`
+            err = errno;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    if (fd < 0) {
+        std::cerr << address << ": " << strerror(err) << "\n";
+        std::exit(1);
+    }
+    return fd;
+}
+
+#endif
@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "columnar.hh"
+#include "udpdgram.hh"
+
+// rpcgame client over UDP.
+//
+// Tries are batched as in the cotamer transport, one batch per datagram.
+// Every in-flight batch keeps its datagram until its response arrives, and
+// is sent again once its retransmission deadline passes. The deadline
+// follows a smoothed RTT estimate (RFC 6298), sampled only from batches
+// sent once, and doubles with each retransmission of the same batch. Two
+// signals trigger a resend before the deadline: a `gap` datagram naming a
+// batch the server is missing, and a response to a later batch, which
+// means the batch's own response was lost.
+// Responses may arrive in any order; the reorder window delivers them in
+// serial order.
+
+namespace {
+
+using namespace std::chrono_literals;
+
+class udp_client {
+public:
+    udp_client(const std::string& address, const client_options& options);
+    ~udp_client();
+
+    void send_try(const char* name, size_t name_len, uint64_t count);
+    void finish();
+
+private:
+    struct in_flight_batch {
+        uint32_t n;
+        unsigned transmissions = 1;
+        steady_clock::time_point opened;    // first try was buffered
+        steady_clock::time_point sent;      // last transmission
+        steady_clock::time_point deadline;  // next retransmission
+        std::string datagram;
+    };
+
+    static constexpr unsigned max_transmissions = 30;
+    static constexpr size_t send_burst = 8;
+
+    int _fd;
+    udp_outbox _outbox;
+    udp_inbox _inbox;
+    flow_controller _flow;
+    latency_recorder _latency;
+    std::string _latency_csv;
+    uint64_t _serial = 1;
+
+    std::vector<try_ref> _batch_buf;
+    size_t _batch_bytes = udp_try_batch_header_size;
+    steady_clock::time_point _batch_start;
+    std::string _counts_column;
+    std::string _name_lens_column;
+
+    std::map<uint64_t, in_flight_batch> _in_flight;   // by first serial
+    size_t _in_flight_tries = 0;
+    reorder_window _window;
+
+    steady_clock::duration _srtt{};
+    steady_clock::duration _rttvar{};
+    steady_clock::duration _rto = 200ms;
+    size_t _retransmissions = 0;
+
+    bool _done_received = false;
+    std::string _server_checksums[2];
+
+    size_t batch_limit() const {
+        return std::min(_flow.batch_size(), udp_max_batch);
+    }
+    bool window_open() const {
+        return _in_flight_tries < _flow.window()
+            && _in_flight.size() < max_batches_in_flight;
+    }
+    void flush_batch();
+    void transmit(in_flight_batch& b);
+    void retransmit(in_flight_batch& b, steady_clock::time_point now);
+    void pump();
+    void process_datagram(std::string_view dg);
+    void update_rto(steady_clock::duration rtt);
+};
+
+int udp_connect(const std::string& address) {
+    addrinfo* ai = udp_resolve(address, false);
+    int fd = -1;
+    for (addrinfo* a = ai; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    if (fd < 0) {
+        std::cerr << "client_connect: " << address << ": " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+    int bufsize = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    return fd;
+}
+
+udp_client::udp_client(const std::string& address, const client_options& options)
+    : _fd(udp_connect(address)), _outbox(_fd), _inbox(_fd),
+      _flow(options), _latency_csv(options.latency_csv),
+      _window(std::max(_flow.window(), flow_controller::max_window)
+              + std::max(_flow.batch_size(), flow_controller::max_batch)) {
+    _batch_buf.reserve(udp_max_batch);
+}
+
+udp_client::~udp_client() {
+    close(_fd);
+}
+
+void udp_client::send_try(const char* name, size_t name_len, uint64_t count) {
+    // a try's varints take at most 10 + 5 bytes
+    size_t try_bytes = name_len + 15;
+    if (udp_try_batch_header_size + try_bytes > udp_max_datagram) {
+        std::cerr << "client: try too large for a UDP datagram\n";
+        std::exit(1);
+    }
+    if (_batch_bytes + try_bytes > udp_max_datagram) {
+        flush_batch();
+    }
+    if (!window_open()) {
+        auto stall_start = steady_clock::now();
+        while (!window_open()) {
+            pump();
+        }
+        _latency.send_blocked.record(steady_clock::now() - stall_start);
+    }
+
+    if (_batch_buf.empty()) {
+        _batch_start = steady_clock::now();
+    }
+    _batch_buf.emplace_back(_serial, name, uint32_t(name_len),
+                            try_ref::literal, 0, count);
+    _batch_bytes += try_bytes;
+    ++_serial;
+
+    if (_batch_buf.size() >= batch_limit()
+        || _in_flight.empty()
+        || ((_batch_buf.size() & 15) == 0
+            && steady_clock::now() - _batch_start >= _flow.flush_deadline())) {
+        flush_batch();
+    }
+}
+
+void udp_client::flush_batch() {
+    if (_batch_buf.empty()) {
+        return;
+    }
+    const try_ref* first = _batch_buf.data();
+    const try_ref* last = first + _batch_buf.size();
+    _counts_column.clear();
+    _name_lens_column.clear();
+    size_t names_size = append_columns(_counts_column, _name_lens_column, first, last);
+
+    auto now = steady_clock::now();
+    in_flight_batch& b = _in_flight[first->serial];
+    b.n = _batch_buf.size();
+    b.opened = _batch_start;
+    std::string& dg = b.datagram;
+    dg.resize(udp_try_batch_header_size);
+    dg[0] = char(udp_try_batch);
+    store_le32(dg.data() + 4, b.n);
+    store_le64(dg.data() + 8, first->serial);
+    store_le32(dg.data() + 16, _counts_column.size());
+    store_le32(dg.data() + 20, _name_lens_column.size());
+    dg.reserve(dg.size() + _counts_column.size() + _name_lens_column.size() + names_size);
+    dg.append(_counts_column);
+    dg.append(_name_lens_column);
+    for (const try_ref* t = first; t != last; ++t) {
+        dg.append(t->name, t->name_len);
+    }
+
+    _in_flight_tries += b.n;
+    _batch_buf.clear();
+    _batch_bytes = udp_try_batch_header_size;
+
+    b.sent = now;
+    b.deadline = now + _rto;
+    transmit(b);
+    // send at once if the server may be idle; otherwise in bursts
+    if (_outbox.size() >= send_burst || _in_flight.size() <= _outbox.size()) {
+        _outbox.flush();
+    }
+}
+
+void udp_client::transmit(in_flight_batch& b) {
+    char* p = _outbox.start();
+    memcpy(p, b.datagram.data(), b.datagram.size());
+    _outbox.finish(b.datagram.size());
+}
+
+// Send queued datagrams, wait for responses until the earliest
+// retransmission deadline, process them, and retransmit overdue batches.
+void udp_client::pump() {
+    _outbox.flush();
+
+    auto now = steady_clock::now();
+    auto deadline = now + _rto;
+    for (auto& [serial, b] : _in_flight) {
+        deadline = std::min(deadline, b.deadline);
+    }
+    int timeout_ms = 0;
+    if (deadline > now) {
+        timeout_ms = std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+    }
+    if (udp_wait_readable(_fd, timeout_ms)) {
+        while (size_t n = _inbox.receive()) {
+            for (size_t i = 0; i != n; ++i) {
+                process_datagram(_inbox.datagram(i));
+            }
+            if (n != udp_mmsg_count) {
+                break;
+            }
+        }
+    }
+
+    now = steady_clock::now();
+    for (auto& [serial, b] : _in_flight) {
+        if (b.deadline > now) {
+            continue;
+        }
+        retransmit(b, now);
+    }
+    _outbox.flush();
+}
+
+void udp_client::retransmit(in_flight_batch& b, steady_clock::time_point now) {
+    if (b.transmissions == max_transmissions) {
+        std::cerr << "client: server not responding\n";
+        std::exit(1);
+    }
+    ++b.transmissions;
+    ++_retransmissions;
+    b.sent = now;
+    auto backoff = _rto * (1U << std::min(b.transmissions - 1, 6U));
+    b.deadline = now + std::min<steady_clock::duration>(backoff, 2s);
+    transmit(b);
+}
+
+void udp_client::update_rto(steady_clock::duration rtt) {
+    if (_srtt == steady_clock::duration::zero()) {
+        _srtt = rtt;
+        _rttvar = rtt / 2;
+    } else {
+        auto err = rtt > _srtt ? rtt - _srtt : _srtt - rtt;
+        _rttvar = (3 * _rttvar + err) / 4;
+        _srtt = (7 * _srtt + rtt) / 8;
+    }
+    _rto = std::clamp<steady_clock::duration>(_srtt + 4 * _rttvar, 5ms, 1s);
+}
+
+void udp_client::process_datagram(std::string_view dg) {
+    if (dg.size() >= udp_try_response_header_size && dg[0] == char(udp_try_response)) {
+        uint32_t n = load_le32(dg.data() + 4);
+        uint64_t serial_base = load_le64(dg.data() + 8);
+        auto it = _in_flight.find(serial_base);
+        if (it == _in_flight.end()) {
+            return;     // response to a retransmission we no longer need
+        }
+        in_flight_batch& b = it->second;
+        auto now = steady_clock::now();
+        // The server answers in serial order, so the responses to earlier
+        // batches sent before this one were lost: resend those at once
+        for (auto jt = _in_flight.begin(); jt != it; ++jt) {
+            if (jt->second.sent < b.sent) {
+                retransmit(jt->second, now);
+            }
+        }
+        if (b.n != n
+            || dg.size() != udp_try_response_header_size + size_t(n) * sizeof(uint64_t)) {
+            std::cerr << "client: unexpected try response\n";
+            std::exit(1);
+        }
+        const char* values = dg.data() + udp_try_response_header_size;
+        for (uint32_t i = 0; i != n; ++i) {
+            _window.put(serial_base + i, load_le64(values + i * sizeof(uint64_t)), now);
+        }
+        auto rtt = now - b.sent;
+        // Karn's rule: a retransmitted batch's RTT is ambiguous
+        if (b.transmissions == 1) {
+            update_rto(rtt);
+            _flow.on_response(serial_base, n, rtt, _serial);
+        }
+        _latency.batch_rtt.record(rtt);
+        auto opened = b.opened;
+        _in_flight_tries -= n;
+        _in_flight.erase(it);
+        _window.deliver(_latency.reorder_wait);
+        _latency.try_latency.record(steady_clock::now() - opened, n);
+    } else if (dg.size() >= 4 && dg[0] == char(udp_done_response)) {
+        dg.remove_prefix(4);
+        for (std::string& ck : _server_checksums) {
+            if (dg.size() < 4 || dg.size() - 4 < load_le32(dg.data())) {
+                std::cerr << "client: bad done response\n";
+                std::exit(1);
+            }
+            ck.assign(dg.substr(4, load_le32(dg.data())));
+            dg.remove_prefix(4 + ck.size());
+        }
+        _done_received = true;
+    } else if (dg.size() >= udp_gap_size && dg[0] == char(udp_gap)) {
+        // a batch never reached the server; resend it unless we just did
+        auto it = _in_flight.find(load_le64(dg.data() + 8));
+        auto now = steady_clock::now();
+        if (it != _in_flight.end() && now - it->second.sent >= _srtt) {
+            retransmit(it->second, now);
+        }
+    }
+}
+
+void udp_client::finish() {
+    flush_batch();
+    while (!_in_flight.empty()) {
+        pump();
+    }
+
+    // `done` carries no serials, so it is simply resent until answered
+    for (unsigned tries = 0; !_done_received; ++tries) {
+        if (tries == max_transmissions) {
+            std::cerr << "client: server not responding\n";
+            std::exit(1);
+        }
+        char* p = _outbox.start();
+        memset(p, 0, udp_done_header_size);
+        p[0] = char(udp_done);
+        store_le64(p + 8, _serial);
+        _outbox.finish(udp_done_header_size);
+        _outbox.flush();
+        auto deadline = steady_clock::now() + std::max<steady_clock::duration>(2 * _rto, 10ms);
+        while (!_done_received && steady_clock::now() < deadline) {
+            auto ms = std::chrono::ceil<std::chrono::milliseconds>(deadline - steady_clock::now());
+            if (udp_wait_readable(_fd, ms.count())) {
+                size_t n = _inbox.receive();
+                for (size_t i = 0; i != n; ++i) {
+                    process_datagram(_inbox.datagram(i));
+                }
+            }
+        }
+    }
+
+    report_checksums(_server_checksums[0], _server_checksums[1]);
+    _flow.report(std::cerr);
+    _latency.report(std::cerr, _latency_csv);
+    std::cerr << std::format("udp: {} retransmissions, rto {:.1f} ms\n",
+                             _retransmissions,
+                             std::chrono::duration<double, std::milli>(_rto).count());
+}
+
+std::unique_ptr<udp_client> client;
+
+}
+
+
+void udp_client_connect(std::string address, const client_options& options) {
+    client = std::make_unique<udp_client>(address, options);
+}
+
+void udp_client_send_try(const char* name, size_t name_len, uint64_t count) {
+    client->send_try(name, name_len, count);
+}
+
+void udp_client_finish() {
+    client->finish();
+}
@@ -0,0 +1,249 @@
+#ifndef CS2620_PSET1_UDPDGRAM_HH
+#define CS2620_PSET1_UDPDGRAM_HH
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include "rpcgame.hh"
+
+// UDP datagram transport, selected by addresses of the form
+// "udp:host:port". Each datagram carries one batch, so a lost datagram
+// costs only its own batch: the client retransmits batches whose responses
+// are overdue, keyed by their first serial. The server commits batches in
+// serial order, holding early arrivals until the gap before them fills
+// (and naming the gap to the client), and answers duplicates from the
+// session's replay buffer.
+//
+// Datagrams start with a one-byte type and three bytes of padding;
+// integers are little-endian. Where available, `sendmmsg` and `recvmmsg`
+// move up to `udp_mmsg_count` datagrams per system call.
+
+constexpr char udp_address_prefix[] = "udp:";
+
+inline bool is_udp_address(const std::string& address) {
+    return address.starts_with(udp_address_prefix);
+}
+
+enum udp_type : uint8_t {
+    udp_try_batch = 1,      // u32 n, u64 serial_base, u32 counts size,
+                            // u32 name_lens size, then the three columns
+                            // of a columnar batch (see `columnar.hh`)
+    udp_try_response = 2,   // u32 n, u64 serial_base, n u64 values
+    udp_done = 3,           // u32 0, u64 first serial never sent
+    udp_done_response = 4,  // u32 size, client checksum,
+                            // u32 size, server checksum
+    udp_gap = 5             // u32 0, u64 first serial the server lacks
+};
+
+constexpr size_t udp_try_batch_header_size = 24;
+constexpr size_t udp_try_response_header_size = 16;
+constexpr size_t udp_done_header_size = 16;
+constexpr size_t udp_gap_size = 16;
+constexpr size_t udp_max_datagram = 32768;
+constexpr size_t udp_max_batch =
+    (udp_max_datagram - udp_try_response_header_size) / sizeof(uint64_t);
+constexpr size_t udp_mmsg_count = 64;
+
+// - split "udp:host:port" and resolve it; exit on failure
+inline addrinfo* udp_resolve(const std::string& address, bool passive) {
+    std::string hostport = address.substr(strlen(udp_address_prefix));
+    size_t colon = hostport.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << address << ": expected udp:host:port\n";
+        std::exit(1);
+    }
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo* ai;
+    std::string host = hostport.substr(0, colon);
+    int r = getaddrinfo(host.c_str(), hostport.c_str() + colon + 1, &hints, &ai);
+    if (r != 0) {
+        std::cerr << address << ": " << gai_strerror(r) << "\n";
+        std::exit(1);
+    }
+    return ai;
+}
+
+// - wait up to `timeout_ms` for `fd` to become readable
+inline bool udp_wait_readable(int fd, int timeout_ms) {
+    pollfd p = {fd, POLLIN, 0};
+    return poll(&p, 1, timeout_ms) > 0;
+}
+
+
+// udp_outbox
+//    Outgoing datagrams, sent together by `flush`. Each has its own
+//    `udp_max_datagram` buffer. A send that fails is dropped; the
+//    retransmission protocol recovers.
+
+class udp_outbox {
+public:
+    explicit udp_outbox(int fd)
+        : _fd(fd), _data(new char[udp_mmsg_count * udp_max_datagram]) {
+    }
+
+    size_t size() const {
+        return _n;
+    }
+
+    // - return the buffer for a new datagram to `addr` (nullptr on a
+    //   connected socket), flushing first if the outbox is full
+    char* start(const sockaddr* addr = nullptr, socklen_t addrlen = 0) {
+        if (_n == udp_mmsg_count) {
+            flush();
+        }
+        _addrlens[_n] = addrlen;
+        if (addrlen) {
+            memcpy(&_addrs[_n], addr, addrlen);
+        }
+        return _data.get() + _n * udp_max_datagram;
+    }
+    // - queue the datagram started last, which is `len` bytes long
+    void finish(size_t len) {
+        _lens[_n] = len;
+        ++_n;
+    }
+
+    inline void flush();
+
+private:
+    int _fd;
+    std::unique_ptr<char[]> _data;
+    size_t _n = 0;
+    size_t _lens[udp_mmsg_count];
+    sockaddr_storage _addrs[udp_mmsg_count];
+    socklen_t _addrlens[udp_mmsg_count];
+};
+
+inline void udp_outbox::flush() {
+#if defined(__linux__)
+    mmsghdr msgs[udp_mmsg_count];
+    iovec iov[udp_mmsg_count];
+    for (size_t i = 0; i != _n; ++i) {
+        iov[i] = {_data.get() + i * udp_max_datagram, _lens[i]};
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (_addrlens[i]) {
+            msgs[i].msg_hdr.msg_name = &_addrs[i];
+            msgs[i].msg_hdr.msg_namelen = _addrlens[i];
+        }
+    }
+    size_t sent = 0;
+    while (sent != _n) {
+        int r = sendmmsg(_fd, msgs + sent, _n - sent, 0);
+        if (r > 0) {
+            sent += r;
+        } else if (r < 0 && errno == EINTR) {
+            continue;
+        } else {
+            // drop this datagram (e.g., ECONNREFUSED) and try the rest
+            ++sent;
+        }
+    }
+#else
+    for (size_t i = 0; i != _n; ++i) {
+        ssize_t r;
+        do {
+            r = sendto(_fd, _data.get() + i * udp_max_datagram, _lens[i], 0,
+                       _addrlens[i] ? reinterpret_cast<sockaddr*>(&_addrs[i]) : nullptr,
+                       _addrlens[i]);
+        } while (r < 0 && errno == EINTR);
+    }
+#endif
+    _n = 0;
+}
+
+
+// udp_inbox
+//    Incoming datagrams, received together by `receive`.
+
+class udp_inbox {
+public:
+    explicit udp_inbox(int fd)
+        : _fd(fd), _data(new char[udp_mmsg_count * udp_max_datagram]) {
+    }
+
+    // - receive up to `udp_mmsg_count` datagrams without blocking; return
+    //   how many arrived
+    inline size_t receive();
+
+    std::string_view datagram(size_t i) const {
+        return {_data.get() + i * udp_max_datagram, _lens[i]};
+    }
+    const sockaddr* source(size_t i) const {
+        return reinterpret_cast<const sockaddr*>(&_addrs[i]);
+    }
+    socklen_t source_len(size_t i) const {
+        return _addrlens[i];
+    }
+
+private:
+    int _fd;
+    std::unique_ptr<char[]> _data;
+    size_t _lens[udp_mmsg_count];
+    sockaddr_storage _addrs[udp_mmsg_count];
+    socklen_t _addrlens[udp_mmsg_count];
+};
+
+inline size_t udp_inbox::receive() {
+#if defined(__linux__)
+    mmsghdr msgs[udp_mmsg_count];
+    iovec iov[udp_mmsg_count];
+    for (size_t i = 0; i != udp_mmsg_count; ++i) {
+        iov[i] = {_data.get() + i * udp_max_datagram, udp_max_datagram};
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &_addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(_addrs[i]);
+    }
+    int r;
+    do {
+        r = recvmmsg(_fd, msgs, udp_mmsg_count, MSG_DONTWAIT, nullptr);
+    } while (r < 0 && errno == EINTR);
+    size_t n = r > 0 ? r : 0;
+    for (size_t i = 0; i != n; ++i) {
+        _lens[i] = msgs[i].msg_len;
+        _addrlens[i] = msgs[i].msg_hdr.msg_namelen;
+    }
+    return n;
+#else
+    size_t n = 0;
+    while (n != udp_mmsg_count) {
+        _addrlens[n] = sizeof(_addrs[n]);
+        ssize_t r = recvfrom(_fd, _data.get() + n * udp_max_datagram,
+                             udp_max_datagram, MSG_DONTWAIT,
+                             reinterpret_cast<sockaddr*>(&_addrs[n]), &_addrlens[n]);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        } else if (r < 0) {
+            break;
+        }
+        _lens[n] = r;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+
+// Implemented in `udpclient.cc` and `udpserver.cc`; `client_connect` and
+// `server_start` call these for "udp:" addresses
+void udp_client_connect(std::string address, const client_options& options);
+void udp_client_send_try(const char* name, size_t name_len, uint64_t count);
+void udp_client_finish();
+void udp_server_start(std::string address);
+
+#endif
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "columnar.hh"
+#include "udpdgram.hh"
+
+// rpcgame server over UDP. One thread receives datagrams with `recvmmsg`,
+// answers them into an outbox, and sends the responses with `sendmmsg`.
+//
+// Each source address is a client with its own session. A batch at the
+// session's next serial is committed at once; a later batch waits in the
+// client's `pending` map until the batches before it arrive, and is
+// answered with a `gap` datagram naming the first missing serial. Batches the
+// session already committed were retransmitted because their responses
+// were lost, so they are answered from the replay buffer. `done` is
+// answered only once every serial before it has committed; the answer is
+// kept, since the client resends `done` until it arrives.
+
+namespace {
+
+// after the last session closes, answer retransmitted `done`s for this
+// long before exiting
+constexpr int linger_ms = 500;
+// early batches held per client; more are dropped and retransmitted later
+constexpr size_t max_pending = 4 * max_batches_in_flight;
+
+struct udp_peer {
+    uint64_t session = 0;
+    uint64_t next_serial = 1;
+    std::map<uint64_t, std::string> pending;    // by first serial
+    bool closed = false;
+    std::string done_response;
+};
+
+class udp_server {
+public:
+    explicit udp_server(int fd)
+        : _outbox(fd), _inbox(fd) {
+    }
+
+    void run(int fd);
+
+private:
+    udp_outbox _outbox;
+    udp_inbox _inbox;
+    std::unordered_map<std::string, udp_peer> _peers;   // by address bytes
+    bool _finished = false;
+
+    void receive(std::string_view dg, const sockaddr* addr, socklen_t addrlen);
+    void process_batch(udp_peer& peer, std::string_view dg,
+                       const sockaddr* addr, socklen_t addrlen);
+    void process_done(udp_peer& peer, uint64_t end_serial,
+                      const sockaddr* addr, socklen_t addrlen);
+};
+
+void udp_server::run(int fd) {
+    while (udp_wait_readable(fd, _finished ? linger_ms : -1)) {
+        while (size_t n = _inbox.receive()) {
+            for (size_t i = 0; i != n; ++i) {
+                receive(_inbox.datagram(i), _inbox.source(i), _inbox.source_len(i));
+            }
+            _outbox.flush();
+            if (n != udp_mmsg_count) {
+                break;
+            }
+        }
+    }
+}
+
+void udp_server::receive(std::string_view dg, const sockaddr* addr,
+                         socklen_t addrlen) {
+    if (dg.size() < udp_done_header_size) {
+        return;
+    }
+    udp_peer& peer = _peers[std::string(reinterpret_cast<const char*>(addr), addrlen)];
+    if (dg[0] == char(udp_try_batch)) {
+        if (peer.closed) {
+            return;
+        }
+        if (peer.session == 0) {
+            peer.session = server_open_session();
+        }
+        uint64_t serial_base = load_le64(dg.data() + 8);
+        if (serial_base > peer.next_serial) {
+            if (peer.pending.size() < max_pending) {
+                peer.pending.try_emplace(serial_base, dg);
+            }
+            char* out = _outbox.start(addr, addrlen);
+            memset(out, 0, udp_gap_size);
+            out[0] = char(udp_gap);
+            store_le64(out + 8, peer.next_serial);
+            _outbox.finish(udp_gap_size);
+            return;
+        }
+        process_batch(peer, dg, addr, addrlen);
+        while (!peer.pending.empty()
+               && peer.pending.begin()->first <= peer.next_serial) {
+            auto node = peer.pending.extract(peer.pending.begin());
+            process_batch(peer, node.mapped(), addr, addrlen);
+        }
+    } else if (dg[0] == char(udp_done)) {
+        process_done(peer, load_le64(dg.data() + 8), addr, addrlen);
+    }
+}
+
+// Commit or replay a batch that starts at or before the next serial.
+// Malformed batches, and duplicates whose responses have left the replay
+// buffer, are dropped.
+void udp_server::process_batch(udp_peer& peer, std::string_view dg,
+                               const sockaddr* addr, socklen_t addrlen) {
+    if (dg.size() < udp_try_batch_header_size) {
+        return;
+    }
+    uint32_t n = load_le32(dg.data() + 4);
+    uint64_t serial_base = load_le64(dg.data() + 8);
+    uint32_t counts_size = load_le32(dg.data() + 16);
+    uint32_t name_lens_size = load_le32(dg.data() + 20);
+    dg.remove_prefix(udp_try_batch_header_size);
+    if (n == 0 || n > udp_max_batch
+        || counts_size > dg.size()
+        || name_lens_size > dg.size() - counts_size) {
+        return;
+    }
+
+    char* out = _outbox.start(addr, addrlen);
+    try {
+        process_columnar_batch(peer.session, serial_base, n,
+                               dg.substr(0, counts_size),
+                               dg.substr(counts_size, name_lens_size),
+                               dg.substr(counts_size + name_lens_size),
+                               out + udp_try_response_header_size);
+    } catch (std::exception&) {
+        return;
+    }
+    memset(out, 0, udp_try_response_header_size);
+    out[0] = char(udp_try_response);
+    store_le32(out + 4, n);
+    store_le64(out + 8, serial_base);
+    _outbox.finish(udp_try_response_header_size + size_t(n) * sizeof(uint64_t));
+    peer.next_serial = std::max(peer.next_serial, serial_base + n);
+}
+
+void udp_server::process_done(udp_peer& peer, uint64_t end_serial,
+                              const sockaddr* addr, socklen_t addrlen) {
+    if (!peer.closed) {
+        // wait for the client to retransmit any batch still missing
+        if (end_serial != peer.next_serial) {
+            return;
+        }
+        if (peer.session == 0) {
+            peer.session = server_open_session();
+        }
+        session_summary sum = server_close_session(peer.session);
+        std::string& r = peer.done_response;
+        r.assign(4, '\0');
+        r[0] = char(udp_done_response);
+        for (const std::string* ck : {&sum.client_checksum, &sum.server_checksum}) {
+            r.resize(r.size() + 4);
+            store_le32(r.data() + r.size() - 4, ck->size());
+            r.append(*ck);
+        }
+        peer.closed = true;
+        peer.pending.clear();
+        _finished = _finished || sum.last;
+    }
+    char* out = _outbox.start(addr, addrlen);
+    memcpy(out, peer.done_response.data(), peer.done_response.size());
+    _outbox.finish(peer.done_response.size());
+}
+
+}
+
+
+void udp_server_start(std::string address) {
+    addrinfo* ai = udp_resolve(address, true);
+    int fd = -1;
+    for (addrinfo* a = ai; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        int yes = 1;
+        if (fd >= 0) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        }
+        if (fd >= 0 && bind(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    if (fd < 0) {
+        std::cerr << address << ": " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+    int bufsize = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    std::cout << "Server listening on " << address << "\n" << std::flush;
+
+    udp_server server(fd);
+    server.run(fd);
+
+    close(fd);
+    std::cout << "Server exiting\n";
+}
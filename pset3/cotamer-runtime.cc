@@ -0,0 +1,100 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <print>
+#include <thread>
+#include <unordered_map>
+#include "cotamer/runtime.hh"
+
+// cotamer-runtime
+//    Regression test for runtime work stealing. Many tasks are spawned on
+//    driver 0 of a 4-thread runtime. Every task must complete, `wait()` and
+//    `stop()` must return, idle drivers must steal some of the tasks, and a
+//    stolen task must run, before and after it suspends, on its thief's
+//    thread.
+
+namespace cot = cotamer;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr unsigned nthreads = 4;
+constexpr size_t ntasks = 2000;
+
+std::atomic<size_t> ncompleted = 0;
+std::atomic<size_t> nstolen = 0;
+std::atomic<size_t> nmisplaced = 0;
+cot::driver* driver0 = nullptr;
+
+// Each driver runs on one thread; remember which
+std::mutex threads_lock;
+std::unordered_map<cot::driver*, std::thread::id> driver_threads;
+
+bool on_own_thread(cot::driver* d) {
+    std::lock_guard<std::mutex> guard(threads_lock);
+    auto [it, inserted] = driver_threads.try_emplace(d, std::this_thread::get_id());
+    return it->second == std::this_thread::get_id();
+}
+
+void spin(std::chrono::microseconds t) {
+    auto end = std::chrono::steady_clock::now() + t;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+cot::task<> probe() {
+    driver0 = cot::driver::current.get();
+    on_own_thread(driver0);
+    co_return;
+}
+
+cot::task<> work() {
+    cot::driver* d = cot::driver::current.get();
+    bool placed = on_own_thread(d);
+    spin(20us);
+    co_await cot::asap();
+    if (!placed
+        || cot::driver::current.get() != d
+        || !on_own_thread(d)) {
+        ++nmisplaced;
+    }
+    if (d != driver0) {
+        ++nstolen;
+    }
+    ++ncompleted;
+}
+
+}
+
+int main() {
+    cot::runtime rt(nthreads);
+    rt.spawn(0, [] { return probe(); });
+    rt.wait();
+
+    for (size_t i = 0; i != ntasks; ++i) {
+        rt.spawn(0, [] { return work(); });
+    }
+    rt.wait();
+    rt.stop();
+
+    bool ok = true;
+    if (ncompleted != ntasks) {
+        std::print(std::cerr, "{} of {} tasks completed\n", ncompleted.load(), ntasks);
+        ok = false;
+    }
+    if (nmisplaced != 0) {
+        std::print(std::cerr, "{} tasks ran off their driver's thread\n", nmisplaced.load());
+        ok = false;
+    }
+    if (nstolen == 0) {
+        std::print(std::cerr, "no tasks were stolen from driver 0\n");
+        ok = false;
+    }
+
+    if (ok) {
+        std::print("cotamer-runtime: OK ({} tasks, {} stolen, {} drivers)\n",
+                   ntasks, nstolen.load(), driver_threads.size());
+    }
+    return ok ? 0 : 1;
+}
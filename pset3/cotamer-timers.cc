@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <print>
+#include "cotamer/cotamer.hh"
+
+// cotamer-timers
+//    Regression test for abandoned timers. A timer that nobody awaits or
+//    refers to must leave its driver's timer set as soon as its last
+//    reference drops, not when it would have fired. Otherwise a loop that
+//    races work against a long timeout, `attempt(work, after(3s))`, piles
+//    up dead timers. This program is built once per timer backend:
+//    `cotamer-timers` uses the heap and `cotamer-timers-wheel` the timing
+//    wheel (`COTAMER_TIMER_WHEEL`).
+
+namespace cot = cotamer;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr size_t nworkers = 1000;
+constexpr size_t nrounds = 1000;
+size_t max_timers = 0;
+
+cot::task<> message() {
+    co_await cot::after(1ms);
+}
+
+// Each worker has at most two live timers: its message's and its timeout's
+cot::task<> worker() {
+    for (size_t i = 0; i != nrounds; ++i) {
+        auto r = co_await cot::attempt(message(), cot::after(3s));
+        if (!r) {
+            std::print(std::cerr, "attempt timed out\n");
+            std::exit(1);
+        }
+        max_timers = std::max(max_timers, cot::driver::current->timer_size());
+    }
+}
+
+bool expect_timers(const char* what, size_t expected) {
+    size_t n = cot::driver::current->timer_size();
+    if (n != expected) {
+        std::print(std::cerr, "{}: timer_size() is {}, expected {}\n",
+                   what, n, expected);
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main() {
+    for (size_t i = 0; i != nworkers; ++i) {
+        worker().detach();
+    }
+    cot::loop();
+    bool ok = true;
+    if (max_timers > 2 * nworkers) {
+        std::print(std::cerr, "attempt loop: peak timer_size() is {}, expected at most {}\n",
+                   max_timers, 2 * nworkers);
+        ok = false;
+    }
+    ok = expect_timers("after attempt loop", 0) && ok;
+
+    {
+        cot::event e = cot::after(1h);
+        ok = expect_timers("pending after(1h)", 1) && ok;
+    }
+    ok = expect_timers("abandoned after(1h)", 0) && ok;
+
+    if (ok) {
+        std::print("cotamer-timers: OK (peak {} timers, {} live)\n",
+                   max_timers, 2 * nworkers);
+    }
+    return ok ? 0 : 1;
+}